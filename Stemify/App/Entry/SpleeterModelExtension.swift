@@ -14,12 +14,14 @@ extension Spleeter.Model {
             return "2 Stems"
         case .model5Stems:
             return "5 Stems"
+        case .model5StemsAnd2Stems:
+            return "5 + 2 Stems"
         @unknown default:
             fatalError()
         }
     }
     
     static var all: [Self] {
-        [.model2Stems, .model5Stems]
+        [.model2Stems, .model5Stems, .model5StemsAnd2Stems]
     }
 }
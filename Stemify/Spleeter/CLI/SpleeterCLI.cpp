@@ -0,0 +1,893 @@
+//
+//  SpleeterCLI.cpp
+//  Stemify
+//
+//  Created by XueyuanXiao on 2025/8/19.
+//
+//  Headless batch driver for the Spleeter core. Not part of the iOS target, see README for how to build it.
+//
+
+#include "AudioProcessor.h"
+#include "FFmpegAudioAdapter.h"
+#include "MappedWaveform.h"
+#include "MemoryTracker.h"
+#include "SeparationModels.h"
+#include "StemMixer.h"
+#include "TFLiteInferenceEngine.h"
+#include "WorkerPool.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr std::int32_t kSampleRate = 44100;
+
+/// @brief Name of the per-input report, written last so that its presence marks a complete output
+constexpr const char* kReportName = "report.json";
+
+/// @brief Name of the optional mix of every stem but the vocals
+constexpr const char* kMinusOneName = "minus_one";
+
+/// @brief Storage type of the stems kept in memory until they are encoded, chosen at build time:
+///        half floats by default, -DSPLEETER_STEM_STORAGE_INT16 for dithered int16, -DSPLEETER_STEM_STORAGE_FLOAT
+///        for full precision.
+#if defined(SPLEETER_STEM_STORAGE_FLOAT)
+using StemSample = float;
+#elif defined(SPLEETER_STEM_STORAGE_INT16)
+using StemSample = std::int16_t;
+#else
+using StemSample = spleeter::Half;
+#endif
+
+/// @brief Most clips handed to one AudioProcessor::ProcessBatch call
+constexpr size_t kMaxClipsPerBatch = 64;
+
+/// @brief Threads used by each TFLite interpreter (see TFLiteInferenceEngine::Init)
+constexpr unsigned kThreadsPerInterpreter = 2;
+
+struct Options {
+    fs::path input;
+    fs::path output_dir;
+    fs::path models_dir{"."};
+    std::string model{"2stems"};
+    std::string format{"mp3"};
+    std::int32_t bitrate{128000};
+    float window_seconds{30.0f};
+    unsigned jobs{0};
+    unsigned decode_threads{0};
+    unsigned processes{0};
+    std::uint64_t memory_per_job_mb{2048};
+    bool overwrite{false};
+    bool telemetry{false};
+    bool minus_one{false};
+    bool derive_2stems{false};
+    bool mixture_consistency{false};
+    float batch_short_seconds{0.0f};
+    float guard_seconds{3.0f};
+};
+
+struct FileReport {
+    fs::path input;
+    fs::path output_dir;
+    bool success{false};
+    bool skipped{false};
+    bool batched{false};
+    bool spilled_stems{false};
+    float window_seconds{0.0f};
+    std::string error{};
+    double audio_seconds{0.0};
+    double decode_seconds{0.0};
+    double separate_seconds{0.0};
+    double encode_seconds{0.0};
+    double total_seconds{0.0};
+    spleeter::ProcessingSummary summary{};
+    spleeter::MemoryUsage memory{};
+};
+
+void PrintUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [options] <input directory | manifest file> <output directory>\n"
+              << "\n"
+              << "Options:\n"
+              << "  --model 2stems|5stems      Separation model (default: 2stems)\n"
+              << "  --models-dir DIR           Directory holding 2stems.tflite / 5stems.tflite (default: .)\n"
+              << "  --format EXT               Output container/extension (default: mp3)\n"
+              << "  --bitrate BPS              Output bitrate (default: 128000)\n"
+              << "  --window SECONDS           Sliding window length (default: 30)\n"
+              << "  --jobs N                   Files processed at once (default: bounded by cores and memory)\n"
+              << "  --memory-per-job MB        Memory budget of each running file, 0 for none (default: 2048).\n"
+              << "                             Files over budget use a smaller window, then spill stems to disk\n"
+              << "  --processes N              Run inference in N worker processes, one file at a time (default: off)\n"
+              << "  --decode-threads N         Segments decoded in parallel per file (default: cores / jobs)\n"
+              << "  --overwrite                Process inputs even if their output is already complete\n"
+              << "  --minus-one                Also render a mix of every stem but the vocals (karaoke)\n"
+              << "  --derive-2stems            With 5stems, also write the 2stems outputs from the same pass\n"
+              << "  --mixture-consistency      Correct the derived stems so that they add up to the input\n"
+              << "  --batch-short SECONDS      Pack inputs shorter than this into shared windows (default: off)\n"
+              << "  --guard SECONDS            Silence between packed inputs (default: 3)\n"
+              << "  --telemetry                Print live per-window telemetry as JSON lines on stderr\n"
+              << "\n"
+              << "A manifest is a text file with one input path per line, lines starting with '#' are ignored.\n";
+}
+
+bool ParseOptions(int argc, char** argv, Options& options) {
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << arg << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+            return argv[++i];
+        };
+        // std::stoi and friends throw std::invalid_argument or std::out_of_range, both std::logic_error
+        try {
+            if (arg == "--model") {
+                options.model = value();
+            } else if (arg == "--models-dir") {
+                options.models_dir = value();
+            } else if (arg == "--format") {
+                options.format = value();
+            } else if (arg == "--bitrate") {
+                options.bitrate = std::stoi(value());
+            } else if (arg == "--window") {
+                options.window_seconds = std::stof(value());
+            } else if (arg == "--jobs") {
+                options.jobs = static_cast<unsigned>(std::stoul(value()));
+            } else if (arg == "--decode-threads") {
+                options.decode_threads = static_cast<unsigned>(std::stoul(value()));
+            } else if (arg == "--processes") {
+                options.processes = static_cast<unsigned>(std::stoul(value()));
+            } else if (arg == "--memory-per-job") {
+                options.memory_per_job_mb = std::stoull(value());
+            } else if (arg == "--overwrite") {
+                options.overwrite = true;
+            } else if (arg == "--minus-one") {
+                options.minus_one = true;
+            } else if (arg == "--derive-2stems") {
+                options.derive_2stems = true;
+            } else if (arg == "--mixture-consistency") {
+                options.mixture_consistency = true;
+            } else if (arg == "--batch-short") {
+                options.batch_short_seconds = std::stof(value());
+            } else if (arg == "--guard") {
+                options.guard_seconds = std::stof(value());
+            } else if (arg == "--telemetry") {
+                options.telemetry = true;
+            } else if (arg == "-h" || arg == "--help") {
+                return false;
+            } else if (!arg.empty() && arg[0] == '-') {
+                std::cerr << "Unknown option " << arg << std::endl;
+                return false;
+            } else {
+                positional.push_back(arg);
+            }
+        } catch (const std::logic_error&) {
+            std::cerr << "Invalid value for " << arg << std::endl;
+            return false;
+        }
+    }
+    if (positional.size() != 2 || (options.model != "2stems" && options.model != "5stems")) {
+        return false;
+    }
+    if (options.derive_2stems &&
+        (options.model != "5stems" || options.processes > 0 || options.batch_short_seconds > 0.0f)) {
+        std::cerr << "--derive-2stems needs --model 5stems and does not combine with --processes or --batch-short"
+                  << std::endl;
+        return false;
+    }
+    if (options.processes > 0 && options.batch_short_seconds > 0.0f) {
+        std::cerr << "--batch-short does not combine with --processes" << std::endl;
+        return false;
+    }
+    options.input = positional[0];
+    options.output_dir = positional[1];
+    return true;
+}
+
+bool IsAudioFile(const fs::path& path) {
+    static const std::vector<std::string> extensions{".mp3", ".wav", ".flac", ".m4a", ".aac",
+                                                     ".ogg", ".opus", ".aif", ".aiff", ".wma"};
+    auto extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return std::find(extensions.begin(), extensions.end(), extension) != extensions.end();
+}
+
+/// @brief Collect inputs from a directory (audio files directly inside it) or from a manifest file
+std::vector<fs::path> CollectInputs(const fs::path& input) {
+    std::vector<fs::path> inputs;
+    if (fs::is_directory(input)) {
+        for (const auto& entry : fs::directory_iterator(input)) {
+            if (entry.is_regular_file() && IsAudioFile(entry.path())) {
+                inputs.push_back(entry.path());
+            }
+        }
+        std::sort(inputs.begin(), inputs.end());
+    } else {
+        std::ifstream manifest(input);
+        std::string line;
+        while (std::getline(manifest, line)) {
+            line.erase(0, line.find_first_not_of(" \t\r"));
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (!line.empty() && line[0] != '#') {
+                inputs.emplace_back(line);
+            }
+        }
+    }
+    return inputs;
+}
+
+/// @brief Prefix of the raw stem files written next to the outputs when a file does not fit its memory budget
+constexpr const char* kSpillPrefix = ".spill-";
+
+/// @brief Number of files to run at once, bounded by the cores and by the memory currently available
+unsigned GetJobCount(const Options& options, size_t nb_inputs) {
+    unsigned jobs = options.jobs;
+    if (jobs == 0) {
+        const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+        jobs = std::max(1u, cores / kThreadsPerInterpreter);
+
+        const auto page_size = static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE));
+#ifdef _SC_AVPHYS_PAGES
+        const auto available_pages = static_cast<std::uint64_t>(sysconf(_SC_AVPHYS_PAGES));
+#else
+        const auto available_pages = static_cast<std::uint64_t>(sysconf(_SC_PHYS_PAGES));
+#endif
+        const std::uint64_t memory_per_job = options.memory_per_job_mb * 1024 * 1024;
+        if (memory_per_job > 0) {
+            const auto memory_jobs = static_cast<unsigned>((available_pages * page_size) / memory_per_job);
+            jobs = std::min(jobs, std::max(1u, memory_jobs));
+        }
+    }
+    return std::max(1u, std::min(jobs, static_cast<unsigned>(std::max<size_t>(1, nb_inputs))));
+}
+
+fs::path GetOutputDir(const Options& options, const fs::path& input) {
+    return options.output_dir / input.stem();
+}
+
+/// @brief Keeps the first input of each output directory and fails the others. Outputs are named after the input's
+///        stem, so a/song.mp3 and b/song.mp3 (or song.mp3 and song.flac) would overwrite each other. Stems are
+///        compared ignoring case, as on the default macOS file systems.
+std::vector<fs::path> RemoveOutputCollisions(const Options& options,
+                                             const std::vector<fs::path>& inputs,
+                                             std::vector<FileReport>& reports) {
+    std::vector<fs::path> unique_inputs;
+    std::map<std::string, fs::path> claimed;
+    for (const auto& input : inputs) {
+        auto key = GetOutputDir(options, input).string();
+        std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+        const auto [it, inserted] = claimed.emplace(key, input);
+        if (inserted) {
+            unique_inputs.push_back(input);
+            continue;
+        }
+        FileReport report{};
+        report.input = input;
+        report.output_dir = GetOutputDir(options, input);
+        report.error = "same output directory as " + it->second.string() + ", rename one of them";
+        reports.push_back(std::move(report));
+    }
+    return unique_inputs;
+}
+
+fs::path GetTrackPath(const Options& options, const fs::path& output_dir, const std::string& track_name) {
+    return output_dir / (track_name + "." + options.format);
+}
+
+/// @brief An output is complete when its report exists and every track was written
+bool IsComplete(const Options& options, const fs::path& output_dir, const std::vector<std::string>& track_names) {
+    std::error_code error;
+    if (!fs::is_regular_file(output_dir / kReportName, error)) {
+        return false;
+    }
+    return std::all_of(track_names.begin(), track_names.end(), [&](const auto& track_name) {
+        const auto track_path = GetTrackPath(options, output_dir, track_name);
+        return fs::is_regular_file(track_path, error) && fs::file_size(track_path, error) > 0;
+    });
+}
+
+std::string JsonEscape(const std::string& value) {
+    std::ostringstream out;
+    for (const char c : value) {
+        switch (c) {
+            case '"':
+                out << "\\\"";
+                break;
+            case '\\':
+                out << "\\\\";
+                break;
+            case '\n':
+                out << "\\n";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+                } else {
+                    out << c;
+                }
+        }
+    }
+    return out.str();
+}
+
+/// @brief Real-time factor: processing wall time per second of audio (lower is faster)
+double GetRealTimeFactor(const FileReport& report) {
+    return report.audio_seconds > 0.0 ? report.total_seconds / report.audio_seconds : 0.0;
+}
+
+/// @brief Writes report.json through a temporary file, returns false with report.error set on failure
+bool WriteReport(FileReport& report) {
+    const auto report_path = report.output_dir / kReportName;
+    const auto tmp_path = report.output_dir / (std::string(kReportName) + ".tmp");
+    {
+        std::ofstream out(tmp_path);
+        out << std::fixed << std::setprecision(3) << "{\n"
+            << "  \"input\": \"" << JsonEscape(report.input.string()) << "\",\n"
+            << "  \"audio_seconds\": " << report.audio_seconds << ",\n"
+            << "  \"decode_seconds\": " << report.decode_seconds << ",\n"
+            << "  \"separate_seconds\": " << report.separate_seconds << ",\n"
+            << "  \"encode_seconds\": " << report.encode_seconds << ",\n"
+            << "  \"total_seconds\": " << report.total_seconds << ",\n"
+            << "  \"batched\": " << (report.batched ? "true" : "false") << ",\n"
+            << "  \"window_seconds\": " << report.window_seconds << ",\n"
+            << "  \"spilled_stems\": " << (report.spilled_stems ? "true" : "false") << ",\n"
+            << "  \"windows\": " << report.summary.windows_total << ",\n"
+            << "  \"average_window_seconds\": " << report.summary.average_window_seconds << ",\n"
+            << "  \"max_window_seconds\": " << report.summary.max_window_seconds << ",\n"
+            << "  \"peak_buffer_bytes\": " << report.summary.peak_buffer_bytes << ",\n"
+            << "  \"memory\": {\"budget_bytes\": " << report.memory.budget_bytes
+            << ", \"peak_bytes\": " << report.memory.total_peak_bytes;
+        for (size_t i = 0; i < spleeter::kNbMemoryStages; ++i) {
+            out << ", \"" << spleeter::GetMemoryStageName(static_cast<spleeter::MemoryStage>(i))
+                << "_peak_bytes\": " << report.memory.peak_bytes[i];
+        }
+        out << "},\n"
+            << "  \"real_time_factor\": " << std::setprecision(4) << GetRealTimeFactor(report) << "\n"
+            << "}\n";
+        out.close();
+        if (!out) {
+            report.error = "could not write " + tmp_path.string();
+            return false;
+        }
+    }
+    std::error_code error;
+    fs::rename(tmp_path, report_path, error);
+    if (error) {
+        report.error = "could not write " + report_path.string() + ": " + error.message();
+        fs::remove(tmp_path, error);
+        return false;
+    }
+    return true;
+}
+
+/// @brief Splits the inputs into units of work: one input each, except inputs shorter than --batch-short which are
+///        grouped so that they share inference windows (while keeping at least one group per job).
+std::vector<std::vector<fs::path>> GetWorkItems(const Options& options, const std::vector<fs::path>& inputs, unsigned jobs) {
+    std::vector<std::vector<fs::path>> work_items;
+    std::vector<fs::path> short_inputs;
+    spleeter::FFmpegAudioAdapter audio_adapter;
+    const auto short_frames = static_cast<std::uint64_t>(options.batch_short_seconds * kSampleRate);
+    for (const auto& input : inputs) {
+        const auto nb_frames = short_frames > 0 ? audio_adapter.Probe(input.string(), kSampleRate).nb_frames : 0;
+        if (nb_frames > 0 && nb_frames < short_frames) {
+            short_inputs.push_back(input);
+        } else {
+            work_items.push_back({input});
+        }
+    }
+
+    const size_t batch_size =
+        std::clamp<size_t>((short_inputs.size() + jobs - 1) / std::max(1u, jobs), 1, kMaxClipsPerBatch);
+    for (size_t begin = 0; begin < short_inputs.size(); begin += batch_size) {
+        const auto end = std::min(begin + batch_size, short_inputs.size());
+        work_items.emplace_back(short_inputs.begin() + begin, short_inputs.begin() + end);
+    }
+    return work_items;
+}
+
+/// @brief Serializes stderr output of the worker threads
+std::mutex log_mutex;
+
+/// @brief Prints the one line outcome of an input, the caller holds log_mutex when worker threads are running
+void PrintReport(const FileReport& report) {
+    if (report.skipped) {
+        std::cerr << "[skip] " << report.input << std::endl;
+    } else if (report.success) {
+        std::cerr << "[done] " << report.input << " " << std::fixed << std::setprecision(1) << report.audio_seconds
+                  << "s audio in " << report.total_seconds << "s (rtf " << std::setprecision(3)
+                  << GetRealTimeFactor(report) << ")" << (report.batched ? " batched" : "") << std::endl;
+    } else {
+        std::cerr << "[fail] " << report.input << ": " << report.error << std::endl;
+    }
+}
+
+/// @brief Keeps the end-of-job summary and optionally streams the live telemetry of one worker
+class TelemetryDelegate : public spleeter::IAudioProcessorDelegate {
+  public:
+    explicit TelemetryDelegate(bool print_telemetry) : print_telemetry_(print_telemetry) {}
+
+    void SetInput(const fs::path& input) { input_ = input; }
+    spleeter::ProcessingSummary GetSummary() const { return summary_; }
+
+    void onProgressUpdate(float progress) override {}
+    void onProcessingStart() override { summary_ = spleeter::ProcessingSummary{}; }
+
+    void onTelemetryUpdate(const spleeter::ProcessingTelemetry& telemetry) override {
+        if (!print_telemetry_) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(log_mutex);
+        std::cerr << std::fixed << std::setprecision(3) << "{\"input\": \"" << JsonEscape(input_.string())
+                  << "\", \"windows_done\": " << telemetry.windows_done
+                  << ", \"windows_total\": " << telemetry.windows_total
+                  << ", \"audio_seconds_per_second\": " << telemetry.audio_seconds_per_second
+                  << ", \"average_window_seconds\": " << telemetry.average_window_seconds
+                  << ", \"eta_seconds\": " << telemetry.eta_seconds
+                  << ", \"buffer_bytes\": " << telemetry.buffer_bytes << "}" << std::endl;
+    }
+
+    void onProcessingFinish(const spleeter::ProcessingSummary& summary) override { summary_ = summary; }
+
+  private:
+    bool print_telemetry_;
+    fs::path input_{};
+    spleeter::ProcessingSummary summary_{};
+};
+
+/// @brief Everything a worker thread keeps alive between files: adapter, processor and a warm engine
+class Worker {
+  public:
+    /// @brief pool runs the inference when not null, the worker then has no engine of its own: the pool forks its
+    ///        replacement workers from this process, which must not have inference threads running
+    Worker(const Options& options, const spleeter::SeparationModel& model, spleeter::WorkerPool* pool)
+        : options_(options),
+          model_(model),
+          pool_(pool),
+          audio_adapter_(),
+          audio_processor_(),
+          telemetry_(std::make_shared<TelemetryDelegate>(options.telemetry)),
+          engine_(pool ? nullptr : std::make_shared<spleeter::TFLiteInferenceEngine>(model.parameters)),
+          memory_tracker_(std::make_shared<spleeter::MemoryTracker>(options.memory_per_job_mb * 1024 * 1024)),
+          derived_stems_(options.derive_2stems ? spleeter::Make2StemsFrom5Stems()
+                                               : std::vector<spleeter::DerivedStem>{}),
+          stem_names_(model.track_names) {
+        for (const auto& derived_stem : derived_stems_) {
+            stem_names_.push_back(derived_stem.name);
+        }
+        output_names_ = stem_names_;
+        if (options.minus_one) {
+            output_names_.push_back(kMinusOneName);
+        }
+        audio_processor_.setDelegate(telemetry_);
+        audio_processor_.setMemoryTracker(memory_tracker_);
+        if (pool_) {
+            pool_->setDelegate(telemetry_);
+        } else {
+            engine_->Init();
+        }
+    }
+
+    /// @brief Processes one file, or several short files packed together when inputs has more than one entry
+    std::vector<FileReport> Process(const std::vector<fs::path>& inputs) {
+        if (inputs.size() == 1) {
+            return {ProcessFile(inputs.front())};
+        }
+        return ProcessClips(inputs);
+    }
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    static double SecondsSince(Clock::time_point begin) {
+        return std::chrono::duration<double>(Clock::now() - begin).count();
+    }
+
+    /// @brief Fills the report of an input that does not need processing, returns true when it can go on
+    bool Prepare(const fs::path& input, FileReport& report) {
+        report.input = input;
+        report.output_dir = GetOutputDir(options_, input);
+
+        if (!options_.overwrite && IsComplete(options_, report.output_dir, output_names_)) {
+            report.success = true;
+            report.skipped = true;
+            return false;
+        }
+        if (pool_ ? !pool_->IsRunning() : !engine_->IsInitialized()) {
+            report.error = "model could not be loaded";
+            return false;
+        }
+        return true;
+    }
+
+    /// @brief Plans a file of nb_frames against the budget, returns false with report.error when it cannot run
+    bool PlanFile(size_t nb_frames, spleeter::MemoryPlan& plan, FileReport& report) {
+        plan = audio_processor_.PlanMemory(nb_frames, model_.track_names.size(), options_.window_seconds,
+                                           sizeof(StemSample), memory_tracker_->GetBudgetBytes(),
+                                           derived_stems_.size());
+        if (!plan.fits) {
+            report.error = "needs about " + std::to_string(plan.peak_bytes >> 20) + " MB, over the memory budget of " +
+                           std::to_string(options_.memory_per_job_mb) + " MB";
+            return false;
+        }
+        if (pool_ && plan.spill_stems) {
+            report.error = "stems over the memory budget of " + std::to_string(options_.memory_per_job_mb) +
+                           " MB would have to be spilled to disk, which --processes does not do";
+            return false;
+        }
+        report.window_seconds =
+            pool_ ? std::min(plan.window_seconds, pool_->GetMaxWindowSeconds()) : plan.window_seconds;
+        report.spilled_stems = plan.spill_stems;
+        return true;
+    }
+
+    FileReport ProcessFile(const fs::path& input) {
+        FileReport report{};
+        if (!Prepare(input, report)) {
+            return report;
+        }
+
+        // Plan the job against the budget before decoding anything
+        const auto num_tracks = model_.track_names.size();
+        const auto properties = audio_adapter_.Probe(input.string(), kSampleRate);
+        spleeter::MemoryPlan plan{};
+        if (!PlanFile(static_cast<size_t>(properties.nb_frames), plan, report)) {
+            return report;
+        }
+        memory_tracker_->ResetPeaks();
+
+        const auto job_begin = Clock::now();
+        auto stage_begin = Clock::now();
+        const auto waveform = audio_adapter_.LoadParallel(input.string(), kSampleRate,
+                                                          static_cast<std::int32_t>(options_.decode_threads));
+        report.decode_seconds = SecondsSince(stage_begin);
+        if (waveform.nb_frames <= 0) {
+            report.error = "could not decode input";
+            return report;
+        }
+        report.audio_seconds = static_cast<double>(waveform.nb_frames) / kSampleRate;
+        // Probe only estimates the duration, plan again if the input turned out longer
+        if (waveform.nb_frames > properties.nb_frames &&
+            !PlanFile(static_cast<size_t>(waveform.nb_frames), plan, report)) {
+            return report;
+        }
+
+        telemetry_->SetInput(input);
+        if (plan.spill_stems) {
+            return SpillAndSave(waveform, plan, job_begin, report);
+        }
+
+        stage_begin = Clock::now();
+        const auto waveforms =
+            pool_ ? pool_->ProcessAudio<StemSample>(waveform, plan.window_seconds)
+                  : audio_processor_.ProcessAudioWithDerivedStems<StemSample>(waveform, engine_, num_tracks,
+                                                                              plan.window_seconds, derived_stems_,
+                                                                              options_.mixture_consistency);
+        report.separate_seconds = SecondsSince(stage_begin);
+        report.summary = telemetry_->GetSummary();
+        report.memory = memory_tracker_->GetUsage();
+
+        stage_begin = Clock::now();
+        if (SaveOutputs(waveforms, report)) {
+            report.encode_seconds = SecondsSince(stage_begin);
+            report.total_seconds = SecondsSince(job_begin);
+            report.success = WriteReport(report);
+        }
+        return report;
+    }
+
+    /// @brief Separates with the stems written to raw files next to the outputs, then encodes them from mappings
+    FileReport SpillAndSave(const spleeter::Waveform& waveform,
+                            const spleeter::MemoryPlan& plan,
+                            Clock::time_point job_begin,
+                            FileReport& report) {
+        std::error_code error;
+        fs::create_directories(report.output_dir, error);
+        std::vector<std::string> spill_paths;
+        for (const auto& stem_name : stem_names_) {
+            spill_paths.push_back((report.output_dir / (kSpillPrefix + stem_name + ".f32")).string());
+        }
+
+        auto stage_begin = Clock::now();
+        const bool separated = audio_processor_.ProcessAudioToFiles(waveform, engine_, model_.track_names.size(),
+                                                                    plan.window_seconds, spill_paths, derived_stems_,
+                                                                    options_.mixture_consistency);
+        report.separate_seconds = SecondsSince(stage_begin);
+        report.summary = telemetry_->GetSummary();
+        report.memory = memory_tracker_->GetUsage();
+
+        std::vector<spleeter::MappedWaveform> stems;
+        if (separated) {
+            for (const auto& spill_path : spill_paths) {
+                stems.emplace_back(spill_path);
+            }
+        } else {
+            report.error = "could not write spilled stems to " + report.output_dir.string();
+        }
+
+        stage_begin = Clock::now();
+        if (separated && SaveOutputs(stems, report)) {
+            report.encode_seconds = SecondsSince(stage_begin);
+            report.total_seconds = SecondsSince(job_begin);
+            report.success = true;
+        }
+        stems.clear();
+        for (const auto& spill_path : spill_paths) {
+            fs::remove(spill_path, error);
+        }
+        if (report.success) {
+            report.success = WriteReport(report);
+        }
+        return report;
+    }
+
+    /// @brief Decodes the clips, separates them with shared windows and saves each one with its own report.
+    ///        The separation time of the batch is attributed to the clips in proportion to their length.
+    std::vector<FileReport> ProcessClips(const std::vector<fs::path>& inputs) {
+        // Plan the batch against the budget before decoding anything, as one job over all the clips. Batches keep
+        // their stems in memory, so one that would have to spill goes file by file instead.
+        size_t nb_frames = 0;
+        for (const auto& input : inputs) {
+            nb_frames += static_cast<size_t>(audio_adapter_.Probe(input.string(), kSampleRate).nb_frames);
+        }
+        const auto plan = audio_processor_.PlanMemory(nb_frames, model_.track_names.size(), options_.window_seconds,
+                                                      sizeof(float), memory_tracker_->GetBudgetBytes());
+        if (!plan.fits || plan.spill_stems) {
+            std::vector<FileReport> reports;
+            for (const auto& input : inputs) {
+                reports.push_back(ProcessFile(input));
+            }
+            return reports;
+        }
+
+        std::vector<FileReport> reports(inputs.size());
+        std::vector<size_t> clip_reports;
+        std::vector<spleeter::Waveform> clips;
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            if (!Prepare(inputs[i], reports[i])) {
+                continue;
+            }
+            const auto stage_begin = Clock::now();
+            auto waveform = audio_adapter_.Load(inputs[i].string(), kSampleRate);
+            reports[i].decode_seconds = SecondsSince(stage_begin);
+            reports[i].batched = true;
+            reports[i].window_seconds = plan.window_seconds;
+            if (waveform.nb_frames <= 0) {
+                reports[i].error = "could not decode input";
+                continue;
+            }
+            reports[i].audio_seconds = static_cast<double>(waveform.nb_frames) / kSampleRate;
+            clip_reports.push_back(i);
+            clips.push_back(std::move(waveform));
+        }
+        if (clips.empty()) {
+            return reports;
+        }
+        memory_tracker_->ResetPeaks();
+
+        const auto stage_begin = Clock::now();
+        telemetry_->SetInput(inputs.front());
+        const auto clip_waveforms = audio_processor_.ProcessBatch(
+            clips, engine_, model_.track_names.size(), plan.window_seconds, options_.guard_seconds);
+        const double separate_seconds = SecondsSince(stage_begin);
+        const auto summary = telemetry_->GetSummary();
+        const auto memory = memory_tracker_->GetUsage();
+
+        double batch_audio_seconds{0.0};
+        for (const auto i : clip_reports) {
+            batch_audio_seconds += reports[i].audio_seconds;
+        }
+        for (size_t clip_idx = 0; clip_idx < clip_reports.size(); ++clip_idx) {
+            auto& report = reports[clip_reports[clip_idx]];
+            report.separate_seconds = separate_seconds * report.audio_seconds / batch_audio_seconds;
+            report.summary = summary;
+            report.memory = memory;
+
+            const auto encode_begin = Clock::now();
+            if (SaveOutputs(clip_waveforms[clip_idx], report)) {
+                report.encode_seconds = SecondsSince(encode_begin);
+                report.total_seconds = report.decode_seconds + report.separate_seconds + report.encode_seconds;
+                report.success = WriteReport(report);
+            }
+        }
+        return reports;
+    }
+
+    template <typename Sample>
+    bool SaveStem(const fs::path& path, const spleeter::BasicWaveform<Sample>& waveform) {
+        return audio_adapter_.Save(path.string(), waveform, kSampleRate, options_.bitrate);
+    }
+
+    bool SaveStem(const fs::path& path, const spleeter::MappedWaveform& waveform) {
+        const float* data = waveform.GetData();
+        const auto channels = waveform.GetNbChannels();
+        return audio_adapter_.Save(
+            path.string(),
+            [data, channels](float* dst, std::int64_t offset, std::int32_t frames) {
+                std::copy(data + offset * channels, data + (offset + frames) * channels, dst);
+            },
+            waveform.GetNbFrames(),
+            kSampleRate,
+            options_.bitrate);
+    }
+
+    /// @brief Encodes the stems (and the minus-one mix if asked for), returns false with report.error on failure.
+    ///        Stems is a vector of BasicWaveform or of MappedWaveform.
+    template <typename Stems>
+    bool SaveOutputs(const Stems& waveforms, FileReport& report) {
+        const auto num_tracks = model_.track_names.size();
+        if (waveforms.size() != stem_names_.size()) {
+            report.error = "separation failed";
+            return false;
+        }
+        std::error_code error;
+        fs::create_directories(report.output_dir, error);
+        if (error) {
+            report.error = "could not create " + report.output_dir.string() + ": " + error.message();
+            return false;
+        }
+        // The report marks a complete output: drop the one of a previous run (--overwrite) before touching its
+        // stems, so that an interrupted rewrite is not taken as complete
+        const auto report_path = report.output_dir / kReportName;
+        fs::remove(report_path, error);
+        if (error) {
+            report.error = "could not remove " + report_path.string() + ": " + error.message();
+            return false;
+        }
+        for (size_t i = 0; i < stem_names_.size(); ++i) {
+            const auto track_path = GetTrackPath(options_, report.output_dir, stem_names_[i]);
+            if (!SaveStem(track_path, waveforms[i])) {
+                report.error = "could not write " + track_path.string();
+                return false;
+            }
+        }
+        if (options_.minus_one) {
+            spleeter::StemMixer mixer(kSampleRate);
+            for (size_t i = 0; i < num_tracks; ++i) {
+                if (model_.track_names[i] != "vocal") {
+                    mixer.AddStem(waveforms[i]);
+                }
+            }
+            const auto track_path = GetTrackPath(options_, report.output_dir, kMinusOneName);
+            if (!audio_adapter_.Save(
+                    track_path.string(),
+                    [&mixer](float* dst, std::int64_t offset, std::int32_t frames) { mixer.Render(dst, offset, frames); },
+                    mixer.GetNbFrames(),
+                    kSampleRate,
+                    options_.bitrate)) {
+                report.error = "could not write " + track_path.string();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const Options& options_;
+    const spleeter::SeparationModel& model_;
+    spleeter::WorkerPool* pool_;
+    spleeter::FFmpegAudioAdapter audio_adapter_;
+    spleeter::AudioProcessor audio_processor_;
+    std::shared_ptr<TelemetryDelegate> telemetry_;
+    std::shared_ptr<spleeter::TFLiteInferenceEngine> engine_;
+    std::shared_ptr<spleeter::MemoryTracker> memory_tracker_;
+    std::vector<spleeter::DerivedStem> derived_stems_;
+    /// @brief Model tracks followed by the derived stems
+    std::vector<std::string> stem_names_;
+    std::vector<std::string> output_names_;
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options{};
+    if (!ParseOptions(argc, argv, options)) {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const auto model_path = (options.models_dir / (options.model + ".tflite")).string();
+    const auto model = options.model == "2stems" ? spleeter::Make2StemsModel(model_path)
+                                                 : spleeter::Make5StemsModel(model_path);
+
+    std::vector<FileReport> reports;
+    const auto inputs = RemoveOutputCollisions(options, CollectInputs(options.input), reports);
+    for (const auto& report : reports) {
+        PrintReport(report);
+    }
+    if (inputs.empty()) {
+        std::cerr << "No inputs found in " << options.input << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // The pool forks its workers, so it has to exist before any thread is started; files then go through it
+    // one at a time and the parallelism comes from its processes.
+    std::unique_ptr<spleeter::WorkerPool> pool;
+    if (options.processes > 0) {
+        pool = std::make_unique<spleeter::WorkerPool>(model.parameters, model.track_names.size(), options.processes,
+                                                      options.window_seconds);
+        if (!pool->IsRunning()) {
+            std::cerr << "Could not start the worker processes" << std::endl;
+            return EXIT_FAILURE;
+        }
+        options.jobs = 1;
+    }
+
+    const auto jobs = GetJobCount(options, inputs.size());
+    if (options.decode_threads == 0) {
+        options.decode_threads = std::max(1u, std::thread::hardware_concurrency() / jobs);
+    }
+    std::cerr << "Processing " << inputs.size() << " file(s) with " << jobs << " job(s)";
+    if (pool) {
+        std::cerr << " and " << options.processes << " worker process(es)";
+    }
+    std::cerr << ", model " << options.model << std::endl;
+
+    const auto work_items = GetWorkItems(options, inputs, jobs);
+
+    std::atomic<size_t> next_item{0};
+    reports.reserve(reports.size() + inputs.size());
+
+    const auto batch_begin = std::chrono::steady_clock::now();
+    auto run_jobs = [&]() {
+        Worker worker(options, model, pool.get());
+        for (auto index = next_item++; index < work_items.size(); index = next_item++) {
+            auto item_reports = worker.Process(work_items[index]);
+
+            std::lock_guard<std::mutex> lock(log_mutex);
+            for (auto& report : item_reports) {
+                PrintReport(report);
+                reports.push_back(std::move(report));
+            }
+        }
+    };
+    if (pool) {
+        // The pool forks replacements for the workers that crash while files are processed, so this process has to
+        // stay single threaded: the files go through the pool from this thread
+        run_jobs();
+    } else {
+        std::vector<std::thread> threads;
+        for (unsigned i = 0; i < jobs; ++i) {
+            threads.emplace_back(run_jobs);
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    const auto batch_seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - batch_begin).count();
+
+    double audio_seconds{0.0};
+    size_t nb_done{0}, nb_skipped{0}, nb_failed{0};
+    for (const auto& report : reports) {
+        audio_seconds += report.audio_seconds;
+        nb_done += report.success && !report.skipped;
+        nb_skipped += report.skipped;
+        nb_failed += !report.success;
+    }
+    std::cerr << std::fixed << std::setprecision(1) << "Finished in " << batch_seconds << "s: " << nb_done
+              << " processed, " << nb_skipped << " skipped, " << nb_failed << " failed, " << audio_seconds
+              << "s of audio (" << std::setprecision(2)
+              << (batch_seconds > 0.0 ? audio_seconds / batch_seconds : 0.0) << "x real time)" << std::endl;
+
+    return nb_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,73 @@
+//
+//  MemoryUsage.h
+//  Stemify
+//
+//  Created by XueyuanXiao on 2025/8/19.
+//
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <ostream>
+
+namespace spleeter {
+/// @brief Stages of a separation job that hold memory
+enum class MemoryStage : std::size_t {
+    /// @brief Decoded input waveform
+    Decode,
+    /// @brief Window copies handed to the model
+    Window,
+    /// @brief Interpreter tensor arena (estimated, the TFLite C API does not expose it)
+    Inference,
+    /// @brief Model outputs copied out of the interpreter
+    Results,
+    /// @brief Accumulated stem buffers
+    Stems,
+};
+
+/// @brief Number of values of MemoryStage
+constexpr std::size_t kNbMemoryStages = 5;
+
+/// @brief Name of a stage as used in reports
+inline const char* GetMemoryStageName(MemoryStage stage) {
+    switch (stage) {
+        case MemoryStage::Decode:
+            return "decode";
+        case MemoryStage::Window:
+            return "window";
+        case MemoryStage::Inference:
+            return "inference";
+        case MemoryStage::Results:
+            return "results";
+        case MemoryStage::Stems:
+            return "stems";
+    }
+    return "unknown";
+}
+
+/// @brief Bytes attributed to each stage of a job, indexed by MemoryStage
+struct MemoryUsage {
+    /// @brief Bytes held right now
+    std::array<std::size_t, kNbMemoryStages> current_bytes;
+
+    /// @brief High-water mark of each stage since the start of the job
+    std::array<std::size_t, kNbMemoryStages> peak_bytes;
+
+    /// @brief High-water mark of the sum of all stages since the start of the job
+    std::size_t total_peak_bytes;
+
+    /// @brief Hard limit of the job, 0 when unlimited
+    std::size_t budget_bytes;
+};
+
+/// @brief Prepare output stream for MemoryUsage
+inline std::ostream& operator<<(std::ostream& out, const MemoryUsage& usage) {
+    out << "MemoryUsage{";
+    for (std::size_t i = 0; i < kNbMemoryStages; ++i) {
+        out << GetMemoryStageName(static_cast<MemoryStage>(i)) << ": " << usage.current_bytes[i] << "/"
+            << usage.peak_bytes[i] << ", ";
+    }
+    out << "total_peak_bytes: " << usage.total_peak_bytes << ", budget_bytes: " << usage.budget_bytes << "}";
+    return out;
+}
+}  // namespace spleeter
@@ -0,0 +1,81 @@
+//
+//  ProcessingTelemetry.h
+//  Stemify
+//
+//  Created by XueyuanXiao on 2025/8/19.
+//
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+
+namespace spleeter {
+/// @brief Live statistics of a running separation, reported after every window
+struct ProcessingTelemetry {
+    /// @brief Number of windows that went through inference
+    std::size_t windows_done;
+
+    /// @brief Number of windows of the whole job
+    std::size_t windows_total;
+
+    /// @brief Seconds of audio separated per second of wall time since the start of the job
+    double audio_seconds_per_second;
+
+    /// @brief Moving average of the wall time spent per window (extract, inference, stitch), in seconds
+    double average_window_seconds;
+
+    /// @brief Estimated wall time until the job is done, in seconds
+    double eta_seconds;
+
+    /// @brief Bytes currently held by the input, stem, window and inference result buffers
+    std::size_t buffer_bytes;
+};
+
+/// @brief End-of-job record of a separation
+struct ProcessingSummary {
+    /// @brief Number of windows that went through inference
+    std::size_t windows_total;
+
+    /// @brief Seconds of audio separated; for a job that did not complete, only what was done before it stopped
+    double audio_seconds;
+
+    /// @brief Wall time of the whole job, in seconds
+    double wall_seconds;
+
+    /// @brief Seconds of audio separated per second of wall time
+    double audio_seconds_per_second;
+
+    /// @brief Mean wall time spent per window, in seconds
+    double average_window_seconds;
+
+    /// @brief Slowest window, in seconds
+    double max_window_seconds;
+
+    /// @brief Highest value of ProcessingTelemetry::buffer_bytes seen during the job
+    std::size_t peak_buffer_bytes;
+
+    /// @brief false when the job stopped early (memory budget, failed inference) or a clip of a batch failed
+    bool completed;
+};
+
+/// @brief Prepare output stream for ProcessingTelemetry
+inline std::ostream& operator<<(std::ostream& out, const ProcessingTelemetry& telemetry) {
+    out << "ProcessingTelemetry{windows: " << telemetry.windows_done << "/" << telemetry.windows_total
+        << ", audio_seconds_per_second: " << telemetry.audio_seconds_per_second
+        << ", average_window_seconds: " << telemetry.average_window_seconds
+        << ", eta_seconds: " << telemetry.eta_seconds << ", buffer_bytes: " << telemetry.buffer_bytes << "}";
+    return out;
+}
+
+/// @brief Prepare output stream for ProcessingSummary
+inline std::ostream& operator<<(std::ostream& out, const ProcessingSummary& summary) {
+    out << "ProcessingSummary{windows_total: " << summary.windows_total << ", audio_seconds: " << summary.audio_seconds
+        << ", wall_seconds: " << summary.wall_seconds
+        << ", audio_seconds_per_second: " << summary.audio_seconds_per_second
+        << ", average_window_seconds: " << summary.average_window_seconds
+        << ", max_window_seconds: " << summary.max_window_seconds
+        << ", peak_buffer_bytes: " << summary.peak_buffer_bytes
+        << ", completed: " << (summary.completed ? "true" : "false") << "}";
+    return out;
+}
+}  // namespace spleeter
@@ -0,0 +1,24 @@
+//
+//  SampleTypes.h
+//  Stemify
+//
+//  Created by XueyuanXiao on 2025/8/19.
+//
+#pragma once
+
+#include <cstdint>
+
+namespace spleeter {
+/// @brief IEEE 754 binary16 sample, stored as its bit pattern.
+///
+/// Half the size of float with an 11 bit mantissa, i.e. a relative precision of about -66 dB that follows the
+/// signal level, which is plenty for stems that are going to a lossy encoder anyway. Like std::int16_t (16 bit
+/// fixed point with TPDF dither, clipped to [-1, 1]) it can be used as the stem type of BasicWaveform<Sample>
+/// and AudioProcessor::ProcessAudio<Sample> instead of float.
+struct Half {
+    std::uint16_t bits;
+};
+
+static_assert(sizeof(Half) == 2, "Half must be 2 bytes");
+
+}  // namespace spleeter
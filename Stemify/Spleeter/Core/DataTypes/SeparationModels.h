@@ -0,0 +1,58 @@
+//
+//  SeparationModels.h
+//  Stemify
+//
+//  Created by XueyuanXiao on 2025/8/19.
+//
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "InferenceEngineParameters.h"
+
+namespace spleeter {
+
+/// @brief Inference parameters of a separation model together with the names of the tracks it produces
+struct SeparationModel {
+    /// @brief Parameters to create the inference engine with
+    InferenceEngineParameters parameters{};
+
+    /// @brief Name of each output track, in the order of parameters.output_tensor_names
+    std::vector<std::string> track_names{};
+};
+
+/// @brief Extra stem computed from the outputs of a model: the sum of some of its tracks
+struct DerivedStem {
+    /// @brief Name of the stem
+    std::string name{};
+
+    /// @brief Indexes of the model tracks summed into the stem
+    std::vector<std::size_t> tracks{};
+};
+
+/// @brief Spleeter 2stems model (vocals / accompaniment) stored at model_path
+inline SeparationModel Make2StemsModel(const std::string& model_path) {
+    return SeparationModel{
+        {model_path, "waveform", {"strided_slice_13", "strided_slice_23"}, "spleeter:2stems"},
+        {"vocal", "accompaniment"}};
+}
+
+/// @brief Spleeter 5stems model (vocals / drums / bass / piano / other) stored at model_path
+inline SeparationModel Make5StemsModel(const std::string& model_path) {
+    return SeparationModel{
+        {model_path,
+         "waveform",
+         {"strided_slice_18", "strided_slice_38", "strided_slice_48", "strided_slice_28", "strided_slice_58"},
+         "spleeter:5stems"},
+        {"vocal", "drums", "bass", "piano", "accompaniment"}};
+}
+
+/// @brief Vocals / accompaniment derived from the 5stems model outputs, so that one inference gives both
+///        variants. The names do not collide with the 5stems track names.
+inline std::vector<DerivedStem> Make2StemsFrom5Stems() {
+    return {{"2stems_vocal", {0}}, {"2stems_accompaniment", {1, 2, 3, 4}}};
+}
+
+}  // namespace spleeter
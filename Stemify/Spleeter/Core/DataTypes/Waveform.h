@@ -12,17 +12,23 @@
 #include <vector>
 
 namespace spleeter {
-struct Waveform {
+/// @brief Interleaved audio samples. Sample is float for everything the decoder, the model and the encoder
+///        exchange; the accumulated stem buffers may use a compact type instead (see SampleTypes.h).
+template <typename Sample = float>
+struct BasicWaveform {
     std::int32_t nb_frames;
     std::int32_t nb_channels;
-    std::vector<float> data;
+    std::vector<Sample> data;
 };
 
+using Waveform = BasicWaveform<float>;
+
 /// @brief List of waveforms
 using Waveforms = std::vector<Waveform>;
 
 /// @brief Provide output stream for waveform (list of samples), prints number of samples it holds.
-inline std::ostream& operator<<(std::ostream& out, const Waveform& waveform) {
+template <typename Sample>
+inline std::ostream& operator<<(std::ostream& out, const BasicWaveform<Sample>& waveform) {
     out << "Waveform{nb_frames: " << waveform.nb_frames << ", nb_channels: " << waveform.nb_channels
         << ", nb_size: " << waveform.data.size() << "}";
     return out;
@@ -9,7 +9,11 @@
 #include <string>
 #include <vector>
 
+#if defined(__APPLE__)
 #import <TensorFlowLiteC/TensorFlowLiteC.h>
+#else
+#include <tensorflow/lite/c/c_api.h>
+#endif
 
 #include "InferenceEngineParameters.h"
 #include "Waveform.h"
@@ -24,6 +28,7 @@ public:
     void Init();
     void Execute(const Waveform& waveform);
     void Shutdown();
+    bool IsInitialized() const;
     Waveforms GetResults() const;
     void ClearResults();
 private:
@@ -174,6 +174,10 @@ void TFLiteInferenceEngine::Shutdown() {
     results_.clear();
 }
 
+bool TFLiteInferenceEngine::IsInitialized() const {
+    return interpreter_ != nullptr;
+}
+
 Waveforms TFLiteInferenceEngine::GetResults() const {
     return results_;
 }
@@ -6,13 +6,53 @@
 //
 
 #include "AudioProcessor.h"
+#include "MemoryTracker.h"
+#include "SampleConversion.h"
 #include "TFLiteInferenceEngine.h"
 #include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
+#include <iostream>
 
 namespace spleeter {
 
+namespace {
+/// Estimated interpreter arena per input frame and per track. TFLite does not expose its arena through the C API;
+/// this matches the windows the iOS app settled on for a 4GB device (28s for 2 stems, 12s for 5 stems).
+constexpr size_t kInferenceBytesPerFramePerTrack = 200;
+
+/// Smallest window PlanMemory degrades to
+constexpr float kMinBudgetWindowSeconds = 4.0f;
+
+bool AreDerivedStemsValid(const std::vector<DerivedStem>& derived_stems, size_t num_tracks) {
+    for (const auto& derived_stem : derived_stems) {
+        for (const auto track_idx : derived_stem.tracks) {
+            if (track_idx >= num_tracks) {
+                std::cerr << "Derived stem " << derived_stem.name << " uses a track the model does not have"
+                          << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/// Stands in for the delegate while ProcessBatch separates clips on their own, so that the batch is reported as a
+/// single job with their numbers folded in
+class SummaryCollector : public IAudioProcessorDelegate {
+public:
+    void onProgressUpdate(float progress) override {}
+    void onProcessingStart() override {}
+    void onProcessingFinish(const ProcessingSummary& summary) override { summary_ = summary; }
+
+    ProcessingSummary GetSummary() const { return summary_; }
+
+private:
+    ProcessingSummary summary_{};
+};
+}  // namespace
+
 AudioProcessor::AudioProcessor() {
 }
 
@@ -23,6 +63,44 @@ void AudioProcessor::setDelegate(std::weak_ptr<IAudioProcessorDelegate> delegate
     delegate_ = delegate;
 }
 
+void AudioProcessor::setMemoryTracker(std::shared_ptr<MemoryTracker> tracker) {
+    memory_tracker_ = tracker;
+}
+
+size_t AudioProcessor::EstimateWindowBytes(size_t num_tracks, float window_seconds) const {
+    const int sample_rate = 44100;
+    const int channels = 2;
+    const size_t window_frames = static_cast<size_t>(window_seconds * sample_rate);
+    const size_t window_bytes = window_frames * channels * sizeof(float);
+    // The engine keeps its outputs while RunInference holds a copy of them
+    const size_t results_bytes = 2 * num_tracks * window_bytes;
+    return window_bytes + kInferenceBytesPerFramePerTrack * window_frames * num_tracks + results_bytes;
+}
+
+MemoryPlan AudioProcessor::PlanMemory(size_t total_frames, size_t num_tracks, float window_seconds,
+                                      size_t stem_sample_bytes, size_t budget_bytes, size_t num_derived_stems) const {
+    const int channels = 2;
+    const size_t input_bytes = total_frames * channels * sizeof(float);
+    const size_t stem_bytes = (num_tracks + num_derived_stems) * total_frames * channels * stem_sample_bytes;
+
+    for (const bool spill_stems : {false, true}) {
+        float window = window_seconds;
+        while (true) {
+            const size_t peak_bytes =
+                input_bytes + (spill_stems ? 0 : stem_bytes) + EstimateWindowBytes(num_tracks, window);
+            if (budget_bytes == 0 || peak_bytes <= budget_bytes) {
+                return MemoryPlan{window, spill_stems, peak_bytes, true};
+            }
+            if (window <= kMinBudgetWindowSeconds) {
+                break;
+            }
+            window = std::max(kMinBudgetWindowSeconds, window / 2.0f);
+        }
+    }
+    const float window = std::min(window_seconds, kMinBudgetWindowSeconds);
+    return MemoryPlan{window, true, input_bytes + EstimateWindowBytes(num_tracks, window), false};
+}
+
 Waveform AudioProcessor::ExtractSubsegment(const Waveform& src, size_t start_frame, size_t frames) {
     Waveform seg;
     seg.nb_frames = static_cast<std::int32_t>(frames);
@@ -37,27 +115,34 @@ Waveform AudioProcessor::ExtractSubsegment(const Waveform& src, size_t start_fra
     return seg;
 }
 
+template <typename Sample>
 void AudioProcessor::CopySubsegment(const Waveform& src, size_t src_start_frame, size_t frames,
-                                   Waveform& dst, size_t dst_start_frame) {
+                                   BasicWaveform<Sample>& dst, size_t dst_start_frame) {
+    if (src.nb_channels == dst.nb_channels) {
+        // Same layout: the frames are one contiguous run of samples on both sides
+        const size_t src_begin = src_start_frame * src.nb_channels;
+        const size_t dst_begin = dst_start_frame * dst.nb_channels;
+        if (src_begin >= src.data.size() || dst_begin >= dst.data.size()) {
+            return;
+        }
+        const size_t count = std::min({frames * src.nb_channels, src.data.size() - src_begin, dst.data.size() - dst_begin});
+        ConvertSamplesAt(src.data.data() + src_begin, dst.data.data() + dst_begin, count, dst_begin);
+        return;
+    }
     for (size_t f = 0; f < frames; ++f) {
         for (std::int32_t ch = 0; ch < src.nb_channels; ++ch) {
             size_t src_idx = (src_start_frame + f) * src.nb_channels + ch;
             size_t dst_idx = (dst_start_frame + f) * dst.nb_channels + ch;
             if (src_idx < src.data.size() && dst_idx < dst.data.size()) {
-                dst.data[dst_idx] = src.data[src_idx];
+                ConvertSamplesAt(&src.data[src_idx], &dst.data[dst_idx], 1, dst_idx);
             }
         }
     }
 }
 
-std::vector<Waveform> AudioProcessor::ProcessAudio(const Waveform& inputWaveform, 
-                                                   std::shared_ptr<TFLiteInferenceEngine> interface_engine, 
-                                                   size_t num_tracks, 
-                                                   float window_seconds) {
+std::vector<WindowPlan> AudioProcessor::PlanWindows(size_t total_frames, float window_seconds) const {
     const int sample_rate = 44100;
 
-    reportStart();
-
     const float step_seconds = window_seconds / 2.0f;
     const float first_take_seconds = window_seconds * 3.0f / 4.0f;
     const float regular_take_seconds = step_seconds;
@@ -68,70 +153,37 @@ std::vector<Waveform> AudioProcessor::ProcessAudio(const Waveform& inputWaveform
     const size_t first_take_frames = static_cast<size_t>(first_take_seconds * sample_rate);
     const size_t regular_take_frames = static_cast<size_t>(regular_take_seconds * sample_rate);
     const size_t regular_offset_frames = static_cast<size_t>(regular_offset_seconds * sample_rate);
-    
-    const size_t total_frames = inputWaveform.nb_frames;
-    const int channels = inputWaveform.nb_channels;
-
-    std::vector<Waveform> track_results(num_tracks);
-    for (size_t i = 0; i < num_tracks; ++i) {
-        track_results[i].nb_frames = static_cast<std::int32_t>(total_frames);
-        track_results[i].nb_channels = channels;
-        track_results[i].data.resize(total_frames * channels, 0.0f);
-    }
 
+    std::vector<WindowPlan> plan;
     size_t result_pos = 0;
     size_t window_start = 0;
     bool is_first_window = true;
-    float last_reported_progress = 0.0f;
-    const float progress_report_threshold = 0.05f;
 
     while (result_pos < total_frames) {
-        float current_progress = static_cast<float>(result_pos) / static_cast<float>(total_frames);
-
-        if (current_progress - last_reported_progress >= progress_report_threshold) {
-            reportProgress(current_progress);
-            last_reported_progress = current_progress;
-        }
-
         size_t window_end = std::min(window_start + window_frames, total_frames);
         size_t current_window_frames = window_end - window_start;
 
         if (current_window_frames == 0) break;
 
-        Waveform window_segment = ExtractSubsegment(inputWaveform, window_start, current_window_frames);
-
-        interface_engine->Init();
-        interface_engine->Execute(window_segment);
-        auto results = interface_engine->GetResults();
-        interface_engine->Shutdown();
-
-        if (results.size() != num_tracks) {
-            std::string error_msg = "The number of returned tracks is inconsistent. Expected "
-                                    + std::to_string(num_tracks)
-                                    + ", but got "
-                                    + std::to_string(results.size());
-            return track_results;
-        }
-
         size_t extract_start, extract_frames;
         if (is_first_window) {
             extract_start = 0;
-            extract_frames = std::min(first_take_frames, static_cast<size_t>(results[0].nb_frames));
-            extract_frames = std::min(extract_frames, total_frames - result_pos);
+            extract_frames = std::min(first_take_frames, current_window_frames);
             is_first_window = false;
         } else {
             extract_start = regular_offset_frames;
-            extract_frames = std::min(regular_take_frames, static_cast<size_t>(results[0].nb_frames) - extract_start);
-            extract_frames = std::min(extract_frames, total_frames - result_pos);
+            if (extract_start >= current_window_frames) {
+                break;
+            }
+            extract_frames = std::min(regular_take_frames, current_window_frames - extract_start);
         }
+        extract_frames = std::min(extract_frames, total_frames - result_pos);
 
-        if (extract_start >= static_cast<size_t>(results[0].nb_frames) || extract_frames == 0) {
+        if (extract_frames == 0) {
             break;
         }
 
-        for (size_t track_idx = 0; track_idx < num_tracks; ++track_idx) {
-            CopySubsegment(results[track_idx], extract_start, extract_frames, track_results[track_idx], result_pos);
-        }
+        plan.push_back(WindowPlan{window_start, current_window_frames, extract_start, extract_frames, result_pos});
 
         result_pos += extract_frames;
         window_start += step_frames;
@@ -141,33 +193,605 @@ std::vector<Waveform> AudioProcessor::ProcessAudio(const Waveform& inputWaveform
         }
     }
 
-    if (result_pos < total_frames) {
-        size_t remaining_frames = total_frames - result_pos;
-        if (window_start < total_frames) {
-            size_t final_window_end = total_frames;
-            size_t final_window_frames = final_window_end - window_start;
-            
-            if (final_window_frames > 0) {
-                Waveform final_segment = ExtractSubsegment(inputWaveform, window_start, final_window_frames);
-                
-                interface_engine->Init();
-                interface_engine->Execute(final_segment);
-                auto results = interface_engine->GetResults();
-                interface_engine->Shutdown();
-
-                size_t copy_frames = std::min(remaining_frames, static_cast<size_t>(results[0].nb_frames));
-                for (size_t track_idx = 0; track_idx < num_tracks; ++track_idx) {
-                    CopySubsegment(results[track_idx], 0, copy_frames, track_results[track_idx], result_pos);
-                }
-            }
+    if (result_pos < total_frames && window_start < total_frames) {
+        const size_t final_window_frames = total_frames - window_start;
+        plan.push_back(WindowPlan{window_start, final_window_frames, 0,
+                                  std::min(total_frames - result_pos, final_window_frames), result_pos});
+    }
+
+    return plan;
+}
+
+bool AudioProcessor::RunWindows(const Waveform& inputWaveform,
+                                TFLiteInferenceEngine& interface_engine,
+                                size_t num_tracks,
+                                float window_seconds,
+                                size_t stem_bytes,
+                                const std::function<void()>& allocate_stems,
+                                const WindowSink& sink) {
+    using Clock = std::chrono::steady_clock;
+    const int sample_rate = 44100;
+
+    reportStart();
+
+    // An engine that was initialized by the caller stays loaded across windows (and across calls), otherwise
+    // the interpreter only lives for a single window to keep the peak memory low.
+    const bool keep_engine_loaded = interface_engine.IsInitialized();
+
+    const size_t total_frames = inputWaveform.nb_frames;
+    const auto plan = PlanWindows(total_frames, window_seconds);
+
+    MemoryTracker* tracker = memory_tracker_.get();
+    const size_t input_bytes = inputWaveform.data.capacity() * sizeof(float);
+    ScopedMemory input_memory(tracker, MemoryStage::Decode, input_bytes);
+    auto stem_memory = ScopedMemory::TryAllocate(tracker, MemoryStage::Stems, stem_bytes);
+
+    const size_t persistent_bytes = input_bytes + stem_bytes;
+    const auto job_begin = Clock::now();
+    const float moving_average_weight = 0.2f;
+    double average_window_seconds = 0.0;
+    double total_window_seconds = 0.0;
+    double max_window_seconds = 0.0;
+    size_t peak_buffer_bytes = persistent_bytes;
+    size_t windows_done = 0;
+    size_t frames_done = 0;
+    bool completed = stem_memory.IsValid();
+    if (completed) {
+        allocate_stems();
+    } else {
+        std::cerr << "The stems exceed the memory budget" << std::endl;
+    }
+
+    float last_reported_progress = 0.0f;
+    const float progress_report_threshold = 0.05f;
+
+    for (const auto& window : plan) {
+        if (!completed) {
+            break;
         }
+        float current_progress = static_cast<float>(window.result_pos) / static_cast<float>(total_frames);
+
+        if (current_progress - last_reported_progress >= progress_report_threshold) {
+            reportProgress(current_progress);
+            last_reported_progress = current_progress;
+        }
+
+        const auto window_begin = Clock::now();
+        const size_t window_bytes = window.window_frames * inputWaveform.nb_channels * sizeof(float);
+        auto window_memory = ScopedMemory::TryAllocate(tracker, MemoryStage::Window, window_bytes);
+        auto inference_memory = ScopedMemory::TryAllocate(
+            tracker, MemoryStage::Inference, kInferenceBytesPerFramePerTrack * window.window_frames * num_tracks);
+        if (!window_memory.IsValid() || !inference_memory.IsValid()) {
+            std::cerr << "Window at frame " << window.window_start << " exceeds the memory budget" << std::endl;
+            completed = false;
+            break;
+        }
+        Waveform window_segment = ExtractSubsegment(inputWaveform, window.window_start, window.window_frames);
+
+        auto results = RunInference(interface_engine, window_segment, keep_engine_loaded);
+
+        size_t results_bytes = 0;
+        for (const auto& result : results) {
+            results_bytes += result.data.capacity() * sizeof(float);
+        }
+        ScopedMemory results_memory(tracker, MemoryStage::Results, results_bytes);
+
+        if (results.size() != num_tracks) {
+            std::cerr << "The number of returned tracks is inconsistent. Expected " << num_tracks << ", but got "
+                      << results.size() << std::endl;
+            completed = false;
+            break;
+        }
+
+        // A model output shorter than the part of the window that is kept would leave silence in the stems
+        size_t result_frames = static_cast<size_t>(results[0].nb_frames);
+        for (const auto& result : results) {
+            result_frames = std::min({result_frames, static_cast<size_t>(result.nb_frames),
+                                      result.data.size() / std::max<size_t>(1, result.nb_channels)});
+        }
+        if (result_frames < window.extract_start + window.extract_frames) {
+            std::cerr << "The model returned " << result_frames << " frames for the window at frame "
+                      << window.window_start << ", " << window.extract_start + window.extract_frames
+                      << " are needed" << std::endl;
+            completed = false;
+            break;
+        }
+        const size_t extract_frames = window.extract_frames;
+
+        sink(results, window, extract_frames);
+
+        const size_t buffer_bytes = persistent_bytes + window_segment.data.capacity() * sizeof(float) + results_bytes;
+        peak_buffer_bytes = std::max(peak_buffer_bytes, buffer_bytes);
+
+        const double window_seconds_taken = std::chrono::duration<double>(Clock::now() - window_begin).count();
+        average_window_seconds = windows_done == 0
+                                     ? window_seconds_taken
+                                     : moving_average_weight * window_seconds_taken +
+                                           (1.0f - moving_average_weight) * average_window_seconds;
+        total_window_seconds += window_seconds_taken;
+        max_window_seconds = std::max(max_window_seconds, window_seconds_taken);
+        ++windows_done;
+        frames_done = window.result_pos + extract_frames;
+
+        const double elapsed_seconds = std::chrono::duration<double>(Clock::now() - job_begin).count();
+        const double audio_seconds_done = static_cast<double>(frames_done) / sample_rate;
+        reportTelemetry(ProcessingTelemetry{
+            windows_done,
+            plan.size(),
+            elapsed_seconds > 0.0 ? audio_seconds_done / elapsed_seconds : 0.0,
+            average_window_seconds,
+            average_window_seconds * static_cast<double>(plan.size() - windows_done),
+            buffer_bytes});
     }
 
     reportProgress(1.0f);
-    
+
+    const double wall_seconds = std::chrono::duration<double>(Clock::now() - job_begin).count();
+    const double audio_seconds = static_cast<double>(completed ? total_frames : frames_done) / sample_rate;
+    reportFinish(ProcessingSummary{
+        windows_done,
+        audio_seconds,
+        wall_seconds,
+        wall_seconds > 0.0 ? audio_seconds / wall_seconds : 0.0,
+        windows_done > 0 ? total_window_seconds / windows_done : 0.0,
+        max_window_seconds,
+        peak_buffer_bytes,
+        completed});
+
+    return completed;
+}
+
+template <typename Sample>
+std::vector<BasicWaveform<Sample>> AudioProcessor::ProcessAudio(const Waveform& inputWaveform,
+                                                                std::shared_ptr<TFLiteInferenceEngine> interface_engine,
+                                                                size_t num_tracks,
+                                                                float window_seconds) {
+    const size_t total_frames = inputWaveform.nb_frames;
+    const int channels = inputWaveform.nb_channels;
+
+    std::vector<BasicWaveform<Sample>> track_results(num_tracks);
+    auto allocate_stems = [&]() {
+        for (auto& track : track_results) {
+            track.nb_frames = static_cast<std::int32_t>(total_frames);
+            track.nb_channels = channels;
+            track.data.resize(total_frames * channels, Sample{});
+        }
+    };
+
+    auto stitch_window = [&](const Waveforms& results, const WindowPlan& window, size_t extract_frames) {
+        for (size_t track_idx = 0; track_idx < num_tracks; ++track_idx) {
+            CopySubsegment(results[track_idx], window.extract_start, extract_frames, track_results[track_idx],
+                           window.result_pos);
+        }
+    };
+
+    // A job stopped by the memory budget or a model failure must not hand back partly filled stems
+    if (!RunWindows(inputWaveform, *interface_engine, num_tracks, window_seconds,
+                    num_tracks * total_frames * channels * sizeof(Sample), allocate_stems, stitch_window)) {
+        return {};
+    }
     return track_results;
 }
 
+template <typename Sample>
+std::vector<BasicWaveform<Sample>> AudioProcessor::ProcessAudioWithDerivedStems(
+    const Waveform& inputWaveform,
+    std::shared_ptr<TFLiteInferenceEngine> interface_engine,
+    size_t num_tracks,
+    float window_seconds,
+    const std::vector<DerivedStem>& derived_stems,
+    bool mixture_consistency) {
+    const size_t total_frames = inputWaveform.nb_frames;
+    const int channels = inputWaveform.nb_channels;
+    const size_t nb_stems = num_tracks + derived_stems.size();
+
+    if (!AreDerivedStemsValid(derived_stems, num_tracks)) {
+        return {};
+    }
+
+    std::vector<BasicWaveform<Sample>> track_results(nb_stems);
+    auto allocate_stems = [&]() {
+        for (auto& track : track_results) {
+            track.nb_frames = static_cast<std::int32_t>(total_frames);
+            track.nb_channels = channels;
+            track.data.resize(total_frames * channels, Sample{});
+        }
+    };
+
+    // Derived stems are summed in float for the kept part of each window, then converted once
+    std::vector<std::vector<float>> derived_windows(derived_stems.size());
+
+    auto stitch_window = [&](const Waveforms& results, const WindowPlan& window, size_t extract_frames) {
+        for (size_t track_idx = 0; track_idx < num_tracks; ++track_idx) {
+            CopySubsegment(results[track_idx], window.extract_start, extract_frames, track_results[track_idx],
+                           window.result_pos);
+        }
+        const size_t dst_begin = window.result_pos * channels;
+        const size_t count = DeriveStems(inputWaveform, results, window, extract_frames, derived_stems,
+                                         mixture_consistency, derived_windows);
+        for (size_t derived_idx = 0; derived_idx < derived_stems.size(); ++derived_idx) {
+            auto& derived_track = track_results[num_tracks + derived_idx];
+            ConvertSamplesAt(derived_windows[derived_idx].data(), derived_track.data.data() + dst_begin, count,
+                             dst_begin);
+        }
+    };
+
+    if (!RunWindows(inputWaveform, *interface_engine, num_tracks, window_seconds,
+                    nb_stems * total_frames * channels * sizeof(Sample), allocate_stems, stitch_window)) {
+        return {};
+    }
+    return track_results;
+}
+
+template std::vector<BasicWaveform<float>> AudioProcessor::ProcessAudioWithDerivedStems<float>(
+    const Waveform&, std::shared_ptr<TFLiteInferenceEngine>, size_t, float, const std::vector<DerivedStem>&, bool);
+template std::vector<BasicWaveform<Half>> AudioProcessor::ProcessAudioWithDerivedStems<Half>(
+    const Waveform&, std::shared_ptr<TFLiteInferenceEngine>, size_t, float, const std::vector<DerivedStem>&, bool);
+template std::vector<BasicWaveform<std::int16_t>> AudioProcessor::ProcessAudioWithDerivedStems<std::int16_t>(
+    const Waveform&, std::shared_ptr<TFLiteInferenceEngine>, size_t, float, const std::vector<DerivedStem>&, bool);
+
+size_t AudioProcessor::DeriveStems(const Waveform& inputWaveform,
+                                   const Waveforms& results,
+                                   const WindowPlan& window,
+                                   size_t extract_frames,
+                                   const std::vector<DerivedStem>& derived_stems,
+                                   bool mixture_consistency,
+                                   std::vector<std::vector<float>>& derived_windows) const {
+    const size_t channels = inputWaveform.nb_channels;
+    if (derived_stems.empty() || results[0].nb_channels != inputWaveform.nb_channels) {
+        return 0;
+    }
+
+    const size_t src_begin = window.extract_start * channels;
+    size_t count = extract_frames * channels;
+    for (const auto& result : results) {
+        count = std::min(count, result.data.size() - std::min(src_begin, result.data.size()));
+    }
+
+    derived_windows.resize(derived_stems.size());
+    for (size_t derived_idx = 0; derived_idx < derived_stems.size(); ++derived_idx) {
+        auto& sum = derived_windows[derived_idx];
+        sum.assign(count, 0.0f);
+        for (const auto track_idx : derived_stems[derived_idx].tracks) {
+            AccumulateSamples(results[track_idx].data.data() + src_begin, sum.data(), count);
+        }
+    }
+
+    if (mixture_consistency) {
+        // Project onto the set of stems summing to the mixture: every derived stem takes an equal share of
+        // whatever the model left out (or added)
+        const auto input_begin = inputWaveform.data.begin() + window.result_pos * channels;
+        std::vector<float> residual(input_begin, input_begin + count);
+        for (const auto& sum : derived_windows) {
+            for (size_t i = 0; i < count; ++i) {
+                residual[i] -= sum[i];
+            }
+        }
+        const float share = 1.0f / static_cast<float>(derived_stems.size());
+        for (auto& sum : derived_windows) {
+            for (size_t i = 0; i < count; ++i) {
+                sum[i] += residual[i] * share;
+            }
+        }
+    }
+    return count;
+}
+
+bool AudioProcessor::ProcessAudioToFiles(const Waveform& inputWaveform,
+                                         std::shared_ptr<TFLiteInferenceEngine> interface_engine,
+                                         size_t num_tracks,
+                                         float window_seconds,
+                                         const std::vector<std::string>& stem_paths,
+                                         const std::vector<DerivedStem>& derived_stems,
+                                         bool mixture_consistency) {
+    const size_t nb_stems = num_tracks + derived_stems.size();
+    if (stem_paths.size() != nb_stems || !AreDerivedStemsValid(derived_stems, num_tracks)) {
+        return false;
+    }
+    const size_t total_frames = inputWaveform.nb_frames;
+    const size_t channels = inputWaveform.nb_channels;
+
+    std::vector<FILE*> files;
+    bool written = true;
+    for (const auto& path : stem_paths) {
+        FILE* file = std::fopen(path.c_str(), "wb");
+        written = written && file;
+        files.push_back(file);
+    }
+
+    // Windows are stitched front to back, so every file is only ever appended to; a gap left by a window the
+    // model returned short is filled with silence.
+    std::vector<size_t> file_frames(nb_stems, 0);
+    std::vector<std::vector<float>> derived_windows;
+    const std::vector<float> silence(4096 * channels, 0.0f);
+    auto pad_to = [&](size_t track_idx, size_t frame) {
+        while (written && file_frames[track_idx] < frame) {
+            const size_t frames = std::min(frame - file_frames[track_idx], silence.size() / channels);
+            const size_t count = frames * channels;
+            written = std::fwrite(silence.data(), sizeof(float), count, files[track_idx]) == count;
+            file_frames[track_idx] += frames;
+        }
+    };
+
+    auto write_window = [&](const Waveforms& results, const WindowPlan& window, size_t extract_frames) {
+        for (size_t track_idx = 0; track_idx < num_tracks && written; ++track_idx) {
+            const auto& result = results[track_idx];
+            const size_t begin = std::min(window.extract_start * channels, result.data.size());
+            const size_t count = std::min(extract_frames * channels, result.data.size() - begin);
+            pad_to(track_idx, window.result_pos);
+            written = std::fwrite(result.data.data() + begin, sizeof(float), count, files[track_idx]) == count;
+            file_frames[track_idx] += count / channels;
+        }
+        const size_t count = DeriveStems(inputWaveform, results, window, extract_frames, derived_stems,
+                                         mixture_consistency, derived_windows);
+        for (size_t derived_idx = 0; derived_idx < derived_stems.size() && written; ++derived_idx) {
+            const size_t stem_idx = num_tracks + derived_idx;
+            pad_to(stem_idx, window.result_pos);
+            written = std::fwrite(derived_windows[derived_idx].data(), sizeof(float), count, files[stem_idx]) == count;
+            file_frames[stem_idx] += count / channels;
+        }
+    };
+
+    bool completed = false;
+    if (written) {
+        completed = RunWindows(inputWaveform, *interface_engine, num_tracks, window_seconds, 0, [] {}, write_window);
+        for (size_t stem_idx = 0; stem_idx < nb_stems; ++stem_idx) {
+            pad_to(stem_idx, total_frames);
+        }
+    }
+
+    for (FILE* file : files) {
+        if (file && std::fclose(file) != 0) {
+            written = false;
+        }
+    }
+    return completed && written;
+}
+
+template void AudioProcessor::CopySubsegment<float>(const Waveform&, size_t, size_t, BasicWaveform<float>&, size_t);
+template void AudioProcessor::CopySubsegment<Half>(const Waveform&, size_t, size_t, BasicWaveform<Half>&, size_t);
+template void AudioProcessor::CopySubsegment<std::int16_t>(const Waveform&, size_t, size_t, BasicWaveform<std::int16_t>&,
+                                                           size_t);
+template std::vector<BasicWaveform<float>> AudioProcessor::ProcessAudio<float>(
+    const Waveform&, std::shared_ptr<TFLiteInferenceEngine>, size_t, float);
+template std::vector<BasicWaveform<Half>> AudioProcessor::ProcessAudio<Half>(
+    const Waveform&, std::shared_ptr<TFLiteInferenceEngine>, size_t, float);
+template std::vector<BasicWaveform<std::int16_t>> AudioProcessor::ProcessAudio<std::int16_t>(
+    const Waveform&, std::shared_ptr<TFLiteInferenceEngine>, size_t, float);
+
+std::vector<std::vector<Waveform>> AudioProcessor::ProcessBatch(const std::vector<Waveform>& clips,
+                                                               std::shared_ptr<TFLiteInferenceEngine> interface_engine,
+                                                               size_t num_tracks,
+                                                               float window_seconds,
+                                                               float guard_seconds) {
+    using Clock = std::chrono::steady_clock;
+    const int sample_rate = 44100;
+    const int channels = 2;
+
+    const size_t window_frames = static_cast<size_t>(window_seconds * sample_rate);
+    const size_t guard_frames = static_cast<size_t>(guard_seconds * sample_rate);
+
+    std::vector<std::vector<Waveform>> clip_results(clips.size());
+
+    // Pack the clips that fit, in order, as [guard][clip][guard][clip]...[guard]; anything else goes alone.
+    std::vector<std::vector<size_t>> packed_windows;
+    std::vector<size_t> lone_clips;
+    size_t packed_frames = window_frames;
+    for (size_t clip_idx = 0; clip_idx < clips.size(); ++clip_idx) {
+        const auto& clip = clips[clip_idx];
+        const size_t clip_frames = static_cast<size_t>(clip.nb_frames);
+        if (clip.nb_channels != channels || clip_frames == 0 || guard_frames + clip_frames + guard_frames > window_frames) {
+            lone_clips.push_back(clip_idx);
+            continue;
+        }
+        if (packed_frames + clip_frames + guard_frames > window_frames) {
+            packed_windows.emplace_back();
+            packed_frames = guard_frames;
+        }
+        packed_windows.back().push_back(clip_idx);
+        packed_frames += clip_frames + guard_frames;
+    }
+
+    size_t total_clip_frames = 0;
+    for (const auto& clip : clips) {
+        total_clip_frames += static_cast<size_t>(clip.nb_frames);
+    }
+    const float progress_frames = static_cast<float>(std::max<size_t>(total_clip_frames, 1));
+
+    // The packed clips and their stems are held for the whole batch, the lone clips are accounted by ProcessAudio
+    MemoryTracker* tracker = memory_tracker_.get();
+    auto get_clip_bytes = [&](const std::vector<size_t>& clip_indices) {
+        size_t bytes = 0;
+        for (const auto clip_idx : clip_indices) {
+            bytes += static_cast<size_t>(clips[clip_idx].nb_frames) * channels * sizeof(float);
+        }
+        return bytes;
+    };
+    size_t packed_clip_bytes = 0;
+    for (const auto& packed_clips : packed_windows) {
+        packed_clip_bytes += get_clip_bytes(packed_clips);
+    }
+    ScopedMemory input_memory(tracker, MemoryStage::Decode, packed_clip_bytes);
+    auto stem_memory = ScopedMemory::TryAllocate(tracker, MemoryStage::Stems, num_tracks * packed_clip_bytes);
+    if (!stem_memory.IsValid()) {
+        std::cerr << "The stems of the batch exceed the memory budget" << std::endl;
+        return std::vector<std::vector<Waveform>>(clips.size());
+    }
+    // Hands the clips of a packed window that could not be run over to ProcessAudio, with their memory
+    auto unpack = [&](const std::vector<size_t>& packed_clips) {
+        packed_clip_bytes -= get_clip_bytes(packed_clips);
+        input_memory.Resize(packed_clip_bytes);
+        stem_memory.Resize(num_tracks * packed_clip_bytes);
+        lone_clips.insert(lone_clips.end(), packed_clips.begin(), packed_clips.end());
+    };
+
+    reportStart();
+
+    const bool keep_engine_loaded = interface_engine->IsInitialized();
+    const auto job_begin = Clock::now();
+    double total_window_seconds = 0.0;
+    double max_window_seconds = 0.0;
+    size_t peak_buffer_bytes = 0;
+    size_t windows_done = 0;
+    size_t audio_frames_done = 0;
+
+    for (const auto& packed_clips : packed_windows) {
+        const auto window_begin = Clock::now();
+
+        size_t packed_window_frames = guard_frames;
+        for (const auto clip_idx : packed_clips) {
+            packed_window_frames += clips[clip_idx].nb_frames + guard_frames;
+        }
+
+        auto window_memory =
+            ScopedMemory::TryAllocate(tracker, MemoryStage::Window, packed_window_frames * channels * sizeof(float));
+        auto inference_memory = ScopedMemory::TryAllocate(
+            tracker, MemoryStage::Inference, kInferenceBytesPerFramePerTrack * packed_window_frames * num_tracks);
+        if (!window_memory.IsValid() || !inference_memory.IsValid()) {
+            std::cerr << "Packed window of clips " << packed_clips.front() << " to " << packed_clips.back()
+                      << " exceeds the memory budget, separating them one by one" << std::endl;
+            unpack(packed_clips);
+            continue;
+        }
+
+        Waveform packed;
+        packed.nb_frames = static_cast<std::int32_t>(packed_window_frames);
+        packed.nb_channels = channels;
+        packed.data.resize(packed_window_frames * channels, 0.0f);
+        std::vector<size_t> clip_offsets;
+        size_t offset = guard_frames;
+        for (const auto clip_idx : packed_clips) {
+            const auto& clip = clips[clip_idx];
+            std::copy(clip.data.begin(), clip.data.begin() + static_cast<size_t>(clip.nb_frames) * channels,
+                      packed.data.begin() + offset * channels);
+            clip_offsets.push_back(offset);
+            offset += clip.nb_frames + guard_frames;
+        }
+
+        auto results = RunInference(*interface_engine, packed, keep_engine_loaded);
+        size_t results_bytes = 0;
+        for (const auto& result : results) {
+            results_bytes += result.data.capacity() * sizeof(float);
+        }
+        ScopedMemory results_memory(tracker, MemoryStage::Results, results_bytes);
+        const size_t packed_end = offset - guard_frames;
+        const bool results_complete = std::all_of(results.begin(), results.end(), [&](const Waveform& result) {
+            return static_cast<size_t>(result.nb_frames) >= packed_end && result.data.size() >= packed_end * channels;
+        });
+        if (results.size() != num_tracks || !results_complete) {
+            std::cerr << "Packed window of clips " << packed_clips.front() << " to " << packed_clips.back()
+                      << " failed, separating them one by one" << std::endl;
+            unpack(packed_clips);
+            continue;
+        }
+
+        for (size_t i = 0; i < packed_clips.size(); ++i) {
+            auto& tracks = clip_results[packed_clips[i]];
+            for (const auto& result : results) {
+                tracks.push_back(ExtractSubsegment(result, clip_offsets[i], clips[packed_clips[i]].nb_frames));
+            }
+            audio_frames_done += clips[packed_clips[i]].nb_frames;
+        }
+
+        const size_t buffer_bytes = packed.data.capacity() * sizeof(float) + results_bytes;
+        peak_buffer_bytes = std::max(peak_buffer_bytes, buffer_bytes);
+
+        const double window_seconds_taken = std::chrono::duration<double>(Clock::now() - window_begin).count();
+        total_window_seconds += window_seconds_taken;
+        max_window_seconds = std::max(max_window_seconds, window_seconds_taken);
+        ++windows_done;
+
+        const double elapsed_seconds = std::chrono::duration<double>(Clock::now() - job_begin).count();
+        const double average_window_seconds = total_window_seconds / windows_done;
+        reportTelemetry(ProcessingTelemetry{
+            windows_done,
+            packed_windows.size(),
+            elapsed_seconds > 0.0 ? static_cast<double>(audio_frames_done) / sample_rate / elapsed_seconds : 0.0,
+            average_window_seconds,
+            average_window_seconds * static_cast<double>(packed_windows.size() - windows_done),
+            buffer_bytes});
+        reportProgress(static_cast<float>(audio_frames_done) / progress_frames);
+    }
+
+    // Clips that did not fit a packed window, or whose window failed, go through the sliding window on their own
+    // with their reports collected into the batch's
+    const auto collector = std::make_shared<SummaryCollector>();
+    const auto delegate = delegate_;
+    delegate_ = collector;
+    for (const auto clip_idx : lone_clips) {
+        clip_results[clip_idx] = ProcessAudio(clips[clip_idx], interface_engine, num_tracks, window_seconds);
+        if (clip_results[clip_idx].size() != num_tracks) {
+            continue;
+        }
+        const auto clip_summary = collector->GetSummary();
+        total_window_seconds += clip_summary.average_window_seconds * clip_summary.windows_total;
+        max_window_seconds = std::max(max_window_seconds, clip_summary.max_window_seconds);
+        peak_buffer_bytes = std::max(peak_buffer_bytes, clip_summary.peak_buffer_bytes);
+        windows_done += clip_summary.windows_total;
+        audio_frames_done += clips[clip_idx].nb_frames;
+        if (auto outer_delegate = delegate.lock()) {
+            outer_delegate->onProgressUpdate(static_cast<float>(audio_frames_done) /
+                                             static_cast<float>(total_clip_frames));
+        }
+    }
+    delegate_ = delegate;
+
+    const double wall_seconds = std::chrono::duration<double>(Clock::now() - job_begin).count();
+    const double audio_seconds = static_cast<double>(audio_frames_done) / sample_rate;
+    const bool completed = std::all_of(clip_results.begin(), clip_results.end(),
+                                       [&](const std::vector<Waveform>& tracks) { return tracks.size() == num_tracks; });
+    reportFinish(ProcessingSummary{
+        windows_done,
+        audio_seconds,
+        wall_seconds,
+        wall_seconds > 0.0 ? audio_seconds / wall_seconds : 0.0,
+        windows_done > 0 ? total_window_seconds / windows_done : 0.0,
+        max_window_seconds,
+        peak_buffer_bytes,
+        completed});
+
+    return clip_results;
+}
+
+Waveforms AudioProcessor::RunInference(TFLiteInferenceEngine& interface_engine,
+                                       const Waveform& segment,
+                                       bool keep_engine_loaded) {
+    if (!keep_engine_loaded) {
+        interface_engine.Init();
+    }
+    interface_engine.Execute(segment);
+    auto results = interface_engine.GetResults();
+    if (keep_engine_loaded) {
+        interface_engine.ClearResults();
+    } else {
+        interface_engine.Shutdown();
+    }
+    return results;
+}
+
+std::vector<Waveform> AudioProcessor::ProcessRegion(const Waveform& paddedWaveform,
+                                                    std::shared_ptr<TFLiteInferenceEngine> interface_engine,
+                                                    size_t num_tracks,
+                                                    float window_seconds,
+                                                    size_t lead_frames,
+                                                    size_t region_frames,
+                                                    const std::vector<DerivedStem>& derived_stems,
+                                                    bool mixture_consistency) {
+    const size_t total_frames = paddedWaveform.nb_frames;
+    lead_frames = std::min(lead_frames, total_frames);
+    region_frames = std::min(region_frames, total_frames - lead_frames);
+
+    auto padded_results = ProcessAudioWithDerivedStems(paddedWaveform, interface_engine, num_tracks, window_seconds,
+                                                       derived_stems, mixture_consistency);
+
+    std::vector<Waveform> region_results;
+    region_results.reserve(padded_results.size());
+    for (const auto& track : padded_results) {
+        region_results.push_back(ExtractSubsegment(track, lead_frames, region_frames));
+    }
+    return region_results;
+}
+
 void AudioProcessor::reportProgress(float progress) {
     if (auto delegate = delegate_.lock()) {
         delegate->onProgressUpdate(progress);
@@ -179,4 +803,16 @@ void AudioProcessor::reportStart() {
         delegate->onProcessingStart();
     }
 }
+
+void AudioProcessor::reportTelemetry(const ProcessingTelemetry& telemetry) {
+    if (auto delegate = delegate_.lock()) {
+        delegate->onTelemetryUpdate(telemetry);
+    }
+}
+
+void AudioProcessor::reportFinish(const ProcessingSummary& summary) {
+    if (auto delegate = delegate_.lock()) {
+        delegate->onProcessingFinish(summary);
+    }
+}
 } // namespace spleeter
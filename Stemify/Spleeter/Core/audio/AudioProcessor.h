@@ -6,13 +6,18 @@
 //
 #pragma once
 
-#include "waveform.h"
+#include "Waveform.h"
+#include "ProcessingTelemetry.h"
+#include "SeparationModels.h"
+#include <functional>
+#include <string>
 #include <vector>
 #include <memory>
 
 namespace spleeter {
 
 class TFLiteInferenceEngine;
+class MemoryTracker;
 
 class IAudioProcessorDelegate {
 public:
@@ -21,6 +26,38 @@ public:
     virtual void onProgressUpdate(float progress) = 0;
 
     virtual void onProcessingStart() = 0;
+
+    /// Called after every window with live throughput, latency, ETA and memory figures.
+    virtual void onTelemetryUpdate(const ProcessingTelemetry& telemetry) {}
+
+    /// Called once when a job is done.
+    virtual void onProcessingFinish(const ProcessingSummary& summary) {}
+};
+
+/// One inference window of the sliding window and the part of its output that is kept
+struct WindowPlan {
+    /// First input frame of the window
+    size_t window_start;
+    /// Number of input frames of the window
+    size_t window_frames;
+    /// First frame of the window output that is kept
+    size_t extract_start;
+    /// Number of output frames that are kept
+    size_t extract_frames;
+    /// Position of the kept frames in the stitched tracks
+    size_t result_pos;
+};
+
+/// How a job is run so that it stays within a memory budget
+struct MemoryPlan {
+    /// Window to use, at most the requested one
+    float window_seconds;
+    /// Stems are written to disk window by window (ProcessAudioToFiles) instead of being kept in memory
+    bool spill_stems;
+    /// Estimated high-water mark of the job, decoded input included
+    size_t peak_bytes;
+    /// false when even the smallest window with spilled stems exceeds the budget
+    bool fits;
 };
 
 class AudioProcessor {
@@ -31,20 +68,124 @@ public:
 
     void setDelegate(std::weak_ptr<IAudioProcessorDelegate> delegate);
 
+    /// Attributes the memory of the following jobs to their stages and enforces the tracker's budget: a window
+    /// that does not fit stops the job. Pass nullptr to disable the accounting.
+    void setMemoryTracker(std::shared_ptr<MemoryTracker> tracker);
+
+    /// Estimated bytes held while one window runs: the window copy, the interpreter arena and the model outputs.
+    size_t EstimateWindowBytes(size_t num_tracks, float window_seconds) const;
+
+    /// Picks how to separate total_frames within budget_bytes (0 means unlimited). The requested window is
+    /// halved down to a minimum first, then the stems are spilled to disk with the largest window that fits.
+    /// stem_sample_bytes is sizeof the Sample the stems are kept as, num_derived_stems the number of stems kept
+    /// besides the model tracks (see ProcessAudioWithDerivedStems).
+    MemoryPlan PlanMemory(size_t total_frames, size_t num_tracks, float window_seconds, size_t stem_sample_bytes,
+                          size_t budget_bytes, size_t num_derived_stems = 0) const;
+
     Waveform ExtractSubsegment(const Waveform& src, size_t start_frame, size_t frames);
 
+    /// Copies frames of a model output into a stem buffer, converting them to the stem sample type.
+    template <typename Sample>
     void CopySubsegment(const Waveform& src, size_t src_start_frame, size_t frames,
-                        Waveform& dst, size_t dst_start_frame);
+                        BasicWaveform<Sample>& dst, size_t dst_start_frame);
 
-    std::vector<Waveform> ProcessAudio(const Waveform& inputWaveform,
-                                       std::shared_ptr<TFLiteInferenceEngine> interface_engine,
-                                       size_t num_tracks,
-                                       float window_seconds);
+    /// Splits total_frames into the windows ProcessAudio runs: windows advance by half a window, the first one
+    /// keeps its first three quarters and every other one keeps its middle half.
+    std::vector<WindowPlan> PlanWindows(size_t total_frames, float window_seconds) const;
+
+    /// Separates the input into num_tracks stems. Sample selects the storage type of the accumulated stems
+    /// (float, Half or std::int16_t, see SampleTypes.h); windows are converted to it while they are stitched.
+    /// Returns no stems when the job stopped early: a window over the memory budget or a failed inference.
+    template <typename Sample = float>
+    std::vector<BasicWaveform<Sample>> ProcessAudio(const Waveform& inputWaveform,
+                                                    std::shared_ptr<TFLiteInferenceEngine> interface_engine,
+                                                    size_t num_tracks,
+                                                    float window_seconds);
+
+    /// Separates the input like ProcessAudio and returns the num_tracks model stems followed by one stem per entry
+    /// of derived_stems, the sum of its tracks, computed while the windows are stitched (e.g. 2-stem output from
+    /// a single 5-stem pass, see Make2StemsFrom5Stems). With mixture_consistency the derived stems are corrected
+    /// to add up to the input by splitting the residual equally between them, so they should partition the tracks.
+    template <typename Sample = float>
+    std::vector<BasicWaveform<Sample>> ProcessAudioWithDerivedStems(const Waveform& inputWaveform,
+                                                                    std::shared_ptr<TFLiteInferenceEngine> interface_engine,
+                                                                    size_t num_tracks,
+                                                                    float window_seconds,
+                                                                    const std::vector<DerivedStem>& derived_stems,
+                                                                    bool mixture_consistency);
+
+    /// Separates the input like ProcessAudio but appends every stitched window to stem_paths[track] (raw
+    /// interleaved stereo float32, see MappedWaveform) instead of keeping the stems in memory. Derived stems, as
+    /// in ProcessAudioWithDerivedStems, go to the paths following the num_tracks model stems.
+    /// Returns false when a file cannot be written or the job did not complete.
+    bool ProcessAudioToFiles(const Waveform& inputWaveform,
+                             std::shared_ptr<TFLiteInferenceEngine> interface_engine,
+                             size_t num_tracks,
+                             float window_seconds,
+                             const std::vector<std::string>& stem_paths,
+                             const std::vector<DerivedStem>& derived_stems = {},
+                             bool mixture_consistency = false);
+
+    /// Separates only the region of interest of an input that was decoded with extra context around it.
+    /// The whole padded input is run through the sliding window so the model sees the margins, and the
+    /// returned tracks are trimmed to [lead_frames, lead_frames + region_frames) of that input. Derived stems are
+    /// appended as in ProcessAudioWithDerivedStems.
+    std::vector<Waveform> ProcessRegion(const Waveform& paddedWaveform,
+                                        std::shared_ptr<TFLiteInferenceEngine> interface_engine,
+                                        size_t num_tracks,
+                                        float window_seconds,
+                                        size_t lead_frames,
+                                        size_t region_frames,
+                                        const std::vector<DerivedStem>& derived_stems = {},
+                                        bool mixture_consistency = false);
+
+    /// Separates many short clips with few inferences: clips are packed back to back into windows of up to
+    /// window_seconds, separated by guard_seconds of silence so the model's receptive field never reaches from
+    /// one clip into the next, and every packed window is run once. Returns num_tracks stems per clip, in the
+    /// order of clips, or no stems for a clip that could not be separated. Clips that do not fit in a window with
+    /// their guards, and the clips of a packed window whose inference failed or that is over the memory budget,
+    /// are processed with ProcessAudio; the delegate still sees a single job. Returns no stems at all when the
+    /// stems of the packed clips are over the memory budget.
+    std::vector<std::vector<Waveform>> ProcessBatch(const std::vector<Waveform>& clips,
+                                                    std::shared_ptr<TFLiteInferenceEngine> interface_engine,
+                                                    size_t num_tracks,
+                                                    float window_seconds,
+                                                    float guard_seconds);
 
 private:
+    /// Receives the kept part of every window: the model outputs, the window and the number of frames to keep
+    using WindowSink = std::function<void(const Waveforms& results, const WindowPlan& window, size_t extract_frames)>;
+
     std::weak_ptr<IAudioProcessorDelegate> delegate_;
+    std::shared_ptr<MemoryTracker> memory_tracker_;
+
+    /// Runs the sliding window over the input and hands every window to sink. stem_bytes is the memory the sink
+    /// holds for the whole job: it is reserved against the budget first, and allocate_stems is only called, to
+    /// allocate it, once it fits. Returns false when the job stopped early.
+    bool RunWindows(const Waveform& inputWaveform,
+                    TFLiteInferenceEngine& interface_engine,
+                    size_t num_tracks,
+                    float window_seconds,
+                    size_t stem_bytes,
+                    const std::function<void()>& allocate_stems,
+                    const WindowSink& sink);
+
+    /// Sums the kept part of a window into one buffer per derived stem and applies the mixture consistency
+    /// correction against the matching input frames. Returns the number of samples of each buffer.
+    size_t DeriveStems(const Waveform& inputWaveform,
+                       const Waveforms& results,
+                       const WindowPlan& window,
+                       size_t extract_frames,
+                       const std::vector<DerivedStem>& derived_stems,
+                       bool mixture_consistency,
+                       std::vector<std::vector<float>>& derived_windows) const;
+
+    /// Runs one window, loading the model around it unless keep_engine_loaded
+    Waveforms RunInference(TFLiteInferenceEngine& interface_engine, const Waveform& segment, bool keep_engine_loaded);
 
     void reportProgress(float progress);
     void reportStart();
+    void reportTelemetry(const ProcessingTelemetry& telemetry);
+    void reportFinish(const ProcessingSummary& summary);
 };
 } // namespace spleeter
@@ -8,7 +8,13 @@
 #include "TFLiteInferenceEngine.h"
 
 #include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <iostream>
 #include <memory>
+#include <numeric>
+#include <thread>
+#include <vector>
 
 namespace spleeter {
 #define MAX_AUDIO_FRAME_SIZE 192000  // 1 second of 48khz 32bit audio
@@ -20,32 +26,40 @@ namespace {
 /// @param audio_codec_context [in/out] - encoder context
 /// @param format_context [in/out] - media format context
 /// @param data_present [out] - writes 1 on encoded data is preset, 0 otherwise.
+/// @param next_pts [in/out] - pts of the given frame, advanced by its number of samples.
 ///
 /// @return ret value - 0 on success, AVERROR (negative value) on error. Exception 0 on EOF.
 static std::int32_t Encode(AVFrame* frame,
                            AVCodecContext* audio_codec_context,
                            AVFormatContext* format_context,
-                           std::int32_t* data_present) {
+                           std::int32_t* data_present,
+                           std::int64_t* next_pts) {
     AVPacket* packet = av_packet_alloc();
 
     *data_present = 0;
 
     if (frame)
     {
-        static std::int64_t pts{0};
-        frame->pts = pts;
-        pts += frame->nb_samples;
+        frame->pts = *next_pts;
+        *next_pts += frame->nb_samples;
     }
     auto ret = avcodec_send_frame(audio_codec_context, frame);
+    if (ret == AVERROR_EOF && !frame) {
+        // Already flushed
+        ret = 0;
+    }
 
     while (ret >= 0)
     {
         ret = avcodec_receive_packet(audio_codec_context, packet);
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
         {
+            ret = 0;
+            break;
+        }
+        if (ret < 0) {
             break;
         }
-
 
         *data_present = 1;
         packet->stream_index = 0;
@@ -54,7 +68,225 @@ static std::int32_t Encode(AVFrame* frame,
     }
 
     av_packet_free(&packet);
-    return 0;
+    return ret;
+}
+
+/// @brief Decoded audio before the requested start that is thrown away to prime the decoder after a seek
+constexpr double kSeekPreRollSeconds = 0.5;
+
+/// @brief Shortest segment worth its own decoder in LoadParallel
+constexpr double kMinParallelSegmentSeconds = 10.0;
+
+/// @brief Frames decoded twice at each LoadParallel seam to check both segments agree on the timeline
+constexpr std::int64_t kSeamCheckFrames = 1024;
+
+/// @brief Largest sample difference accepted between two decodes of the same seam frames
+constexpr float kSeamTolerance = 1e-4f;
+
+/// @brief Decode the span [start_frame, start_frame + nb_frames) of the given media file into dst.
+///
+/// Frames are counted at the output sample rate. When start_frame is not zero the demuxer seeks to the
+/// closest point before (start_frame - pre-roll), decoded samples are placed on the timeline using the
+/// frame timestamps and everything outside the requested span is discarded, which makes the result
+/// sample-accurate regardless of where before the span the seek landed; a seek landing inside the span (lead
+/// frames included) fails rather than leaving its head silent. The first decoded samples are also trimmed so
+/// the resampler starts on an input sample that falls exactly on an output sample, so its output grid matches
+/// the one of a decode from the start of the file.
+///
+/// @param path [in]         - Path of the audio file to decode.
+/// @param sample_rate [in]  - Output sample rate.
+/// @param start_frame [in]  - First output frame to write.
+/// @param nb_frames [in]    - Number of output frames to write at most.
+/// @param dst [out]         - Interleaved stereo destination, holds at least nb_frames * 2 samples.
+/// @param lead_frames [in]  - Number of frames right before start_frame to write to lead_dst.
+/// @param lead_dst [out]    - Interleaved stereo destination of the lead frames, may be null if lead_frames is 0.
+///
+/// @return number of frames written (may be less than nb_frames at the end of the stream), -1 on error.
+static std::int64_t DecodeSpan(const std::string& path,
+                               const std::int32_t sample_rate,
+                               const std::int64_t start_frame,
+                               const std::int64_t nb_frames,
+                               float* dst,
+                               const std::int64_t lead_frames = 0,
+                               float* lead_dst = nullptr) {
+    AVFormatContext* format_context{nullptr};
+    if (avformat_open_input(&format_context, path.c_str(), nullptr, nullptr) < 0) {
+        return -1;
+    }
+    if (avformat_find_stream_info(format_context, nullptr) < 0) {
+        avformat_close_input(&format_context);
+        return -1;
+    }
+
+    const auto stream_index = av_find_best_stream(format_context, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+    if (stream_index < 0) {
+        avformat_close_input(&format_context);
+        return -1;
+    }
+    AVStream* audio_stream = format_context->streams[stream_index];
+
+    const AVCodec* audio_codec = avcodec_find_decoder(audio_stream->codecpar->codec_id);
+    AVCodecContext* audio_codec_context = avcodec_alloc_context3(audio_codec);
+    if (!audio_codec || !audio_codec_context ||
+        avcodec_parameters_to_context(audio_codec_context, audio_stream->codecpar) < 0 ||
+        avcodec_open2(audio_codec_context, audio_codec, nullptr) < 0) {
+        avcodec_free_context(&audio_codec_context);
+        avformat_close_input(&format_context);
+        return -1;
+    }
+
+    SwrContext* swr_context{nullptr};
+    AVChannelLayout out_ch_layout = AV_CHANNEL_LAYOUT_STEREO;
+    if (swr_alloc_set_opts2(&swr_context,
+                            &out_ch_layout,
+                            AV_SAMPLE_FMT_FLT,
+                            sample_rate,
+                            &audio_codec_context->ch_layout,
+                            audio_codec_context->sample_fmt,
+                            audio_codec_context->sample_rate,
+                            0,
+                            nullptr) < 0 ||
+        swr_init(swr_context) < 0) {
+        swr_free(&swr_context);
+        avcodec_free_context(&audio_codec_context);
+        avformat_close_input(&format_context);
+        return -1;
+    }
+
+    const AVRational output_time_base{1, sample_rate};
+    const std::int32_t input_sample_rate = audio_codec_context->sample_rate;
+    const AVRational input_time_base{1, input_sample_rate};
+    const std::int64_t resampler_grid = input_sample_rate / std::gcd(input_sample_rate, sample_rate);
+    const std::int64_t stream_start =
+        audio_stream->start_time != AV_NOPTS_VALUE ? audio_stream->start_time : 0;
+
+    const bool seeked = start_frame > 0;
+    if (seeked) {
+        const auto pre_roll_frames = static_cast<std::int64_t>(kSeekPreRollSeconds * sample_rate);
+        const auto target_frame = std::max<std::int64_t>(0, start_frame - lead_frames - pre_roll_frames);
+        const auto target_ts = stream_start + av_rescale_q(target_frame, output_time_base, audio_stream->time_base);
+        if (av_seek_frame(format_context, stream_index, target_ts, AVSEEK_FLAG_BACKWARD) < 0) {
+            swr_free(&swr_context);
+            avcodec_free_context(&audio_codec_context);
+            avformat_close_input(&format_context);
+            return -1;
+        }
+        avcodec_flush_buffers(audio_codec_context);
+    }
+
+    const std::int64_t end_frame = start_frame + nb_frames;
+    const std::int64_t lead_start_frame = start_frame - lead_frames;
+    std::int64_t position{seeked ? -1 : 0};
+    std::int64_t written{0};
+    bool failed{false};
+    std::vector<float> converted;
+
+    /// Place converted samples on the output timeline and keep the part inside the requested span
+    auto store = [&](std::int32_t converted_frames) {
+        const auto chunk_begin = position;
+        const auto chunk_end = position + converted_frames;
+        const auto lead_copy_begin = std::max(chunk_begin, lead_start_frame);
+        const auto lead_copy_end = std::min(chunk_end, start_frame);
+        if (lead_copy_begin < lead_copy_end) {
+            std::copy(converted.begin() + (lead_copy_begin - chunk_begin) * 2,
+                      converted.begin() + (lead_copy_end - chunk_begin) * 2,
+                      lead_dst + (lead_copy_begin - lead_start_frame) * 2);
+        }
+        const auto copy_begin = std::max(chunk_begin, start_frame);
+        const auto copy_end = std::min(chunk_end, end_frame);
+        if (copy_begin < copy_end) {
+            std::copy(converted.begin() + (copy_begin - chunk_begin) * 2,
+                      converted.begin() + (copy_end - chunk_begin) * 2,
+                      dst + (copy_begin - start_frame) * 2);
+            written = std::max(written, copy_end - start_frame);
+        }
+        position = chunk_end;
+    };
+
+    auto convert = [&](const AVFrame* frame, std::int32_t skip_samples) {
+        const auto in_samples = frame ? frame->nb_samples - skip_samples : 0;
+        const auto max_out_samples = swr_get_out_samples(swr_context, in_samples);
+        if (max_out_samples <= 0) {
+            return 0;
+        }
+        converted.resize(static_cast<size_t>(max_out_samples) * 2);
+        auto* out = reinterpret_cast<std::uint8_t*>(converted.data());
+        std::vector<const std::uint8_t*> in;
+        if (frame) {
+            const auto sample_format = static_cast<AVSampleFormat>(frame->format);
+            const bool planar = av_sample_fmt_is_planar(sample_format);
+            const auto nb_planes = planar ? frame->ch_layout.nb_channels : 1;
+            const auto skip_bytes = static_cast<std::int64_t>(skip_samples) * av_get_bytes_per_sample(sample_format) *
+                                    (planar ? 1 : frame->ch_layout.nb_channels);
+            for (auto plane = 0; plane < nb_planes; ++plane) {
+                in.push_back(frame->extended_data[plane] + skip_bytes);
+            }
+        }
+        const auto converted_frames = swr_convert(swr_context,
+                                                  &out,
+                                                  max_out_samples,
+                                                  frame ? in.data() : nullptr,
+                                                  in_samples);
+        return std::max(converted_frames, 0);
+    };
+
+    auto receive_frames = [&](AVFrame* frame) {
+        while (avcodec_receive_frame(audio_codec_context, frame) >= 0) {
+            std::int32_t skip_samples{0};
+            if (position < 0) {
+                if (frame->best_effort_timestamp == AV_NOPTS_VALUE) {
+                    failed = true;
+                    return;
+                }
+                const auto input_position = av_rescale_q(frame->best_effort_timestamp - stream_start,
+                                                         audio_stream->time_base,
+                                                         input_time_base);
+                skip_samples = static_cast<std::int32_t>(
+                    ((-input_position % resampler_grid) + resampler_grid) % resampler_grid);
+                if (skip_samples >= frame->nb_samples) {
+                    av_frame_unref(frame);
+                    continue;
+                }
+                position = av_rescale_q(input_position + skip_samples, input_time_base, output_time_base);
+                if (position > std::max<std::int64_t>(0, lead_start_frame)) {
+                    // The seek landed after the span: its head would be left silent
+                    failed = true;
+                    return;
+                }
+            }
+            store(convert(frame, skip_samples));
+            av_frame_unref(frame);
+            if (position >= end_frame) {
+                return;
+            }
+        }
+    };
+
+    AVPacket* packet = av_packet_alloc();
+    AVFrame* frame = av_frame_alloc();
+    while (!failed && (position < end_frame) && av_read_frame(format_context, packet) >= 0) {
+        if (packet->stream_index == stream_index && avcodec_send_packet(audio_codec_context, packet) >= 0) {
+            receive_frames(frame);
+        }
+        av_packet_unref(packet);
+    }
+
+    /// Drain the decoder and the resampler when the stream ended inside the span
+    if (!failed && position >= 0 && position < end_frame) {
+        avcodec_send_packet(audio_codec_context, nullptr);
+        receive_frames(frame);
+        if (!failed && position < end_frame) {
+            store(convert(nullptr, 0));
+        }
+    }
+
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    swr_free(&swr_context);
+    avcodec_free_context(&audio_codec_context);
+    avformat_close_input(&format_context);
+
+    return failed ? -1 : written;
 }
 } // name space
 
@@ -65,10 +297,17 @@ Waveform FFmpegAudioAdapter::Load(const std::string& path, const std::int32_t sa
     AVFormatContext* format_context = avformat_alloc_context();
 
     auto ret = avformat_open_input(&format_context, path.c_str(), nullptr, nullptr);
+    if (ret < 0) {
+        return Waveform{};  // avformat_open_input frees the context on failure
+    }
 
     ret = avformat_find_stream_info(format_context, nullptr);
 
     ret = av_find_best_stream(format_context, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+    if (ret < 0) {
+        avformat_close_input(&format_context);
+        return Waveform{};  // No audio stream
+    }
     auto stream_index = ret;
     AVStream* audio_stream = format_context->streams[stream_index];
 
@@ -159,25 +398,221 @@ Waveform FFmpegAudioAdapter::Load(const std::string& path, const std::int32_t sa
     return waveform;
 }
 
-void FFmpegAudioAdapter::Save(const std::string& path,
+Waveform FFmpegAudioAdapter::LoadRegion(const std::string& path,
+                                        const std::int32_t sample_rate,
+                                        const double start_seconds,
+                                        const double end_seconds) {
+    const auto start_frame = static_cast<std::int64_t>(std::llround(std::max(0.0, start_seconds) * sample_rate));
+    const auto end_frame = static_cast<std::int64_t>(std::llround(std::max(0.0, end_seconds) * sample_rate));
+
+    Waveform waveform{};
+    waveform.nb_channels = 2;
+    waveform.data.assign(static_cast<size_t>(std::max<std::int64_t>(0, end_frame - start_frame)) * 2, 0.0f);
+
+    auto nb_frames = DecodeSpan(path, sample_rate, start_frame, end_frame - start_frame, waveform.data.data());
+    if (nb_frames < 0) {
+        /// Not seekable or no usable timestamps, fall back to decoding the whole file and slicing it
+        const auto full_waveform = Load(path, sample_rate);
+        const auto full_frames = static_cast<std::int64_t>(full_waveform.data.size() / 2);
+        const auto copy_begin = std::min(start_frame, full_frames);
+        const auto copy_end = std::min(end_frame, full_frames);
+        std::copy(full_waveform.data.begin() + copy_begin * 2,
+                  full_waveform.data.begin() + copy_end * 2,
+                  waveform.data.begin());
+        nb_frames = copy_end - copy_begin;
+    }
+
+    waveform.data.resize(static_cast<size_t>(nb_frames) * 2);
+    waveform.nb_frames = static_cast<std::int32_t>(nb_frames);
+
+    audio_properties_.nb_channels = waveform.nb_channels;
+    audio_properties_.nb_frames = nb_frames;
+    audio_properties_.sample_rate = sample_rate;
+
+    return waveform;
+}
+
+AudioProperties FFmpegAudioAdapter::Probe(const std::string& path, const std::int32_t sample_rate) const {
+    AudioProperties properties{0, 0, static_cast<std::uint32_t>(sample_rate)};
+    AVFormatContext* format_context{nullptr};
+    if (avformat_open_input(&format_context, path.c_str(), nullptr, nullptr) < 0) {
+        return properties;
+    }
+    const auto stream_index = avformat_find_stream_info(format_context, nullptr) >= 0
+                                  ? av_find_best_stream(format_context, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0)
+                                  : -1;
+    if (stream_index >= 0) {
+        const AVStream* audio_stream = format_context->streams[stream_index];
+        properties.nb_channels = audio_stream->codecpar->ch_layout.nb_channels;
+        if (audio_stream->duration != AV_NOPTS_VALUE && audio_stream->duration > 0) {
+            properties.nb_frames = av_rescale_q(audio_stream->duration, audio_stream->time_base, AVRational{1, sample_rate});
+        } else if (format_context->duration != AV_NOPTS_VALUE && format_context->duration > 0) {
+            properties.nb_frames = av_rescale_q(format_context->duration, AVRational{1, AV_TIME_BASE}, AVRational{1, sample_rate});
+        }
+    }
+    avformat_close_input(&format_context);
+    return properties;
+}
+
+Waveform FFmpegAudioAdapter::LoadParallel(const std::string& path,
+                                          const std::int32_t sample_rate,
+                                          const std::int32_t nb_segments) {
+    ///
+    /// Probe length and seekability
+    ///
+    std::int64_t estimated_frames{0};
+    bool seekable{false};
+    AVFormatContext* format_context{nullptr};
+    if (avformat_open_input(&format_context, path.c_str(), nullptr, nullptr) >= 0) {
+        const auto stream_index = avformat_find_stream_info(format_context, nullptr) >= 0
+                                      ? av_find_best_stream(format_context, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0)
+                                      : -1;
+        if (stream_index >= 0) {
+            const AVStream* audio_stream = format_context->streams[stream_index];
+            if (audio_stream->duration != AV_NOPTS_VALUE && audio_stream->duration > 0) {
+                estimated_frames = av_rescale_q(audio_stream->duration, audio_stream->time_base, AVRational{1, sample_rate});
+            } else if (format_context->duration != AV_NOPTS_VALUE && format_context->duration > 0) {
+                estimated_frames = av_rescale_q(format_context->duration, AVRational{1, AV_TIME_BASE}, AVRational{1, sample_rate});
+            }
+        }
+        seekable = format_context->pb && (format_context->pb->seekable & AVIO_SEEKABLE_NORMAL);
+        avformat_close_input(&format_context);
+    }
+
+    const auto min_segment_frames = static_cast<std::int64_t>(kMinParallelSegmentSeconds * sample_rate);
+    const auto segments = static_cast<std::int32_t>(
+        std::min<std::int64_t>(nb_segments, estimated_frames / std::max<std::int64_t>(1, min_segment_frames)));
+    if (!seekable || segments < 2) {
+        return Load(path, sample_rate);
+    }
+
+    ///
+    /// Decode every segment on its own thread, straight into its range of the destination
+    ///
+    /// Container durations are estimates, the last segment decodes to the end of the stream into some slack.
+    const std::int64_t capacity_frames = estimated_frames + estimated_frames / 100 + 2 * sample_rate;
+
+    Waveform waveform{};
+    waveform.nb_channels = 2;
+    waveform.data.assign(static_cast<size_t>(capacity_frames) * 2, 0.0f);
+
+    std::vector<std::int64_t> segment_starts(segments + 1);
+    for (std::int32_t k = 0; k < segments; ++k) {
+        segment_starts[k] = estimated_frames * k / segments;
+    }
+    segment_starts[segments] = capacity_frames;
+
+    std::vector<std::int64_t> written(segments, -1);
+    std::vector<std::vector<float>> seams(segments);
+    std::vector<std::thread> threads;
+    for (std::int32_t k = 0; k < segments; ++k) {
+        threads.emplace_back([&, k]() {
+            const auto start_frame = segment_starts[k];
+            const auto lead_frames = k > 0 ? std::min(kSeamCheckFrames, start_frame) : 0;
+            seams[k].resize(static_cast<size_t>(lead_frames) * 2);
+            written[k] = DecodeSpan(path,
+                                    sample_rate,
+                                    start_frame,
+                                    segment_starts[k + 1] - start_frame,
+                                    waveform.data.data() + start_frame * 2,
+                                    lead_frames,
+                                    seams[k].data());
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    ///
+    /// Every segment but the last must be complete, the last must have reached the end of the stream
+    /// and each seam must match the tail of the previous segment, otherwise decode sequentially.
+    ///
+    bool valid = written[segments - 1] >= 0 && written[segments - 1] < capacity_frames - segment_starts[segments - 1];
+    for (std::int32_t k = 0; valid && k < segments - 1; ++k) {
+        valid = written[k] == segment_starts[k + 1] - segment_starts[k];
+    }
+    for (std::int32_t k = 1; valid && k < segments; ++k) {
+        const auto* previous_tail = waveform.data.data() + segment_starts[k] * 2 - seams[k].size();
+        for (size_t idx = 0; valid && idx < seams[k].size(); ++idx) {
+            valid = std::fabs(seams[k][idx] - previous_tail[idx]) <= kSeamTolerance;
+        }
+    }
+    if (!valid) {
+        // Release the parallel decode first, so that only one decoded copy is ever held
+        waveform.data.clear();
+        waveform.data.shrink_to_fit();
+        seams.clear();
+        seams.shrink_to_fit();
+        return Load(path, sample_rate);
+    }
+
+    const auto nb_frames = segment_starts[segments - 1] + written[segments - 1];
+    waveform.data.resize(static_cast<size_t>(nb_frames) * 2);
+    waveform.nb_frames = static_cast<std::int32_t>(nb_frames);
+
+    audio_properties_.nb_channels = waveform.nb_channels;
+    audio_properties_.nb_frames = nb_frames;
+    audio_properties_.sample_rate = sample_rate;
+
+    return waveform;
+}
+
+bool FFmpegAudioAdapter::Save(const std::string& path,
                               const Waveform& waveform,
                               const std::int32_t sample_rate,
                               const std::int32_t bitrate) {
+    // waveform.data.size() is the total samples, so nb_frames = total_samples / channels
+    const auto nb_frames = static_cast<std::int64_t>(waveform.data.size() / 2);  // Stereo: 2 channels
+    const float* src_float_data = waveform.data.data();
+    return Save(
+        path,
+        [src_float_data](float* dst, std::int64_t offset, std::int32_t frames) {
+            std::memcpy(dst, src_float_data + offset * 2, frames * 2 * sizeof(float));
+        },
+        nb_frames,
+        sample_rate,
+        bitrate);
+}
+
+bool FFmpegAudioAdapter::Save(const std::string& path,
+                              const SampleSource& source,
+                              const std::int64_t nb_frames,
+                              const std::int32_t sample_rate,
+                              const std::int32_t bitrate) {
     ///
     /// Open Output Audio
     ///
     AVFormatContext* format_context{nullptr};
-    auto ret = avformat_alloc_output_context2(&format_context, nullptr, nullptr, path.c_str());
+    AVCodecContext* audio_codec_context{nullptr};
+    AVFrame* frame{nullptr};
+    bool file_opened{false};
+
+    // Releases everything allocated so far and reports the outcome, printing the libav error on failure
+    auto finish = [&](std::int32_t ret, const char* stage) {
+        if (ret < 0) {
+            char message[AV_ERROR_MAX_STRING_SIZE]{};
+            av_strerror(ret, message, sizeof(message));
+            std::cerr << "Could not save " << path << ": " << stage << " failed (" << message << ")" << std::endl;
+        }
+        if (file_opened && avio_closep(&format_context->pb) < 0 && ret >= 0) {
+            std::cerr << "Could not save " << path << ": closing the file failed" << std::endl;
+            ret = AVERROR(EIO);
+        }
+        av_frame_free(&frame);
+        avcodec_free_context(&audio_codec_context);
+        avformat_free_context(format_context);
+        return ret >= 0;
+    };
 
-    if (!format_context) {
-        return; // Failed to allocate format context
+    auto ret = avformat_alloc_output_context2(&format_context, nullptr, nullptr, path.c_str());
+    if (ret < 0 || !format_context) {
+        return finish(ret < 0 ? ret : AVERROR(ENOMEM), "allocating the output context");
     }
 
     const AVOutputFormat* output_format = format_context->oformat;
 
     if (!output_format) {
-        avformat_free_context(format_context);
-        return; // No output format found
+        return finish(AVERROR_MUXER_NOT_FOUND, "finding the output format");
     }
 
     const AVCodec* audio_codec = avcodec_find_encoder(output_format->audio_codec);
@@ -187,25 +622,20 @@ void FFmpegAudioAdapter::Save(const std::string& path,
         audio_codec = avcodec_find_encoder(AV_CODEC_ID_MP3);
     }
 
-    // If still no codec found, return with error
     if (!audio_codec) {
-        avformat_free_context(format_context);
-        return; // or throw an exception
+        return finish(AVERROR_ENCODER_NOT_FOUND, "finding an encoder");
     }
 
     AVStream* audio_stream = avformat_new_stream(format_context, nullptr);
 
     if (!audio_stream) {
-        avformat_free_context(format_context);
-        return; // Failed to create audio stream
+        return finish(AVERROR(ENOMEM), "creating the audio stream");
     }
 
-    AVCodecContext* audio_codec_context = avcodec_alloc_context3(audio_codec);
+    audio_codec_context = avcodec_alloc_context3(audio_codec);
 
-    // Check if context allocation was successful
     if (!audio_codec_context) {
-        avformat_free_context(format_context);
-        return; // or throw an exception
+        return finish(AVERROR(ENOMEM), "allocating the encoder");
     }
 
     ///
@@ -230,14 +660,23 @@ void FFmpegAudioAdapter::Save(const std::string& path,
     /// Open Codec
     ///
     ret = avcodec_open2(audio_codec_context, audio_codec, nullptr);
+    if (ret < 0) {
+        return finish(ret, "opening the encoder");
+    }
 
     ret = avcodec_parameters_from_context(audio_stream->codecpar, audio_codec_context);
+    if (ret < 0) {
+        return finish(ret, "setting the stream parameters");
+    }
     av_dump_format(format_context, 0, path.c_str(), 1);
 
     if (!(format_context->flags & AVFMT_NOFILE))
     {
         ret = avio_open(&format_context->pb, path.c_str(), AVIO_FLAG_WRITE);
-
+        if (ret < 0) {
+            return finish(ret, "opening the file");
+        }
+        file_opened = true;
     }
 
     if (audio_codec_context->codec &&
@@ -250,8 +689,10 @@ void FFmpegAudioAdapter::Save(const std::string& path,
     ///
     /// Allocate sample frame
     ///
-    AVFrame* frame = av_frame_alloc();
-
+    frame = av_frame_alloc();
+    if (!frame) {
+        return finish(AVERROR(ENOMEM), "allocating a frame");
+    }
 
     frame->nb_samples = audio_codec_context->frame_size;
     frame->format = audio_codec_context->sample_fmt;
@@ -259,37 +700,48 @@ void FFmpegAudioAdapter::Save(const std::string& path,
     frame->sample_rate = audio_codec_context->sample_rate;
 
     ret = av_frame_get_buffer(frame, 0);
+    if (ret < 0) {
+        return finish(ret, "allocating the frame buffer");
+    }
 
     ret = av_frame_make_writable(frame);
+    if (ret < 0) {
+        return finish(ret, "making the frame writable");
+    }
 
     // Note: No resampling needed as waveform.data is already in the target format
 
 
     ///
-    /// Prepare for encoding (waveform.data is already in correct format)
+    /// Prepare for encoding (the source produces interleaved stereo float, the target format)
     ///
     std::uint8_t** dst_data{nullptr};
     std::int32_t dst_linesize{0};
-    // waveform.data.size() is the total samples, so nb_frames = total_samples / channels
-    std::int32_t src_nb_samples = waveform.data.size() / 2; // Stereo: 2 channels
+    std::int64_t src_nb_samples = nb_frames;
 
     ///
     /// Start encoding process
     ///
     ret = avformat_write_header(format_context, nullptr);
+    if (ret < 0) {
+        return finish(ret, "writing the header");
+    }
 
     ///
     /// Encode samples in batches
     ///
-    std::int32_t samples_processed = 0;
+    std::int64_t samples_processed = 0;
     std::int32_t data_present{0};
-    // Use waveform.data directly as it's already in float format
-    const float* src_float_data = waveform.data.data();
+    std::int64_t next_pts{0};
+    // Interleaved batch pulled from the source
+    std::vector<float> batch(static_cast<size_t>(audio_codec_context->frame_size) * 2);
+    const float* src_float_data = batch.data();
 
     while (samples_processed < src_nb_samples) {
         // Calculate how many samples to process in this batch
-        std::int32_t samples_this_batch = std::min(audio_codec_context->frame_size,
-                                                   src_nb_samples - samples_processed);
+        std::int32_t samples_this_batch = static_cast<std::int32_t>(
+            std::min<std::int64_t>(audio_codec_context->frame_size, src_nb_samples - samples_processed));
+        source(batch.data(), samples_processed, samples_this_batch);
 
         // Allocate frame buffer for this batch
         ret = av_samples_alloc_array_and_samples(&dst_data,
@@ -298,11 +750,13 @@ void FFmpegAudioAdapter::Save(const std::string& path,
                                                  samples_this_batch,
                                                  audio_codec_context->sample_fmt,
                                                  0);
+        if (ret < 0) {
+            return finish(ret, "allocating samples");
+        }
 
         // Copy data for this batch
-        // waveform.data is interleaved stereo: [L0, R0, L1, R1, L2, R2, ...]
-        // src_offset should be in terms of individual float samples (not frames)
-        std::int32_t src_offset = samples_processed * 2; // 2 channels (stereo)
+        // batch is interleaved stereo: [L0, R0, L1, R1, L2, R2, ...]
+        std::int32_t src_offset = 0;
 
         if (audio_codec_context->sample_fmt == AV_SAMPLE_FMT_FLTP) {
             // Planar format: separate channels
@@ -325,12 +779,16 @@ void FFmpegAudioAdapter::Save(const std::string& path,
         frame->data[1] = dst_data[1];
 
         // Encode this frame
-        ret = Encode(frame, audio_codec_context, format_context, &data_present);
+        ret = Encode(frame, audio_codec_context, format_context, &data_present, &next_pts);
 
         // Free this batch's buffer
         av_freep(&dst_data[0]);
         av_freep(&dst_data);
 
+        if (ret < 0) {
+            return finish(ret, "encoding");
+        }
+
         samples_processed += samples_this_batch;
     }
 
@@ -339,24 +797,14 @@ void FFmpegAudioAdapter::Save(const std::string& path,
     ///
     data_present = 0;
     do {
-        ret = Encode(nullptr, audio_codec_context, format_context, &data_present);
+        ret = Encode(nullptr, audio_codec_context, format_context, &data_present, &next_pts);
+        if (ret < 0) {
+            return finish(ret, "flushing the encoder");
+        }
     } while (data_present);
 
     ret = av_write_trailer(format_context);
-
-    ///
-    /// Cleanup
-    ///
-    if (format_context && !(format_context->flags & AVFMT_NOFILE))
-    {
-        ret = avio_close(format_context->pb);
-
-    }
-    avcodec_close(audio_codec_context);
-    av_frame_free(&frame);
-    avcodec_free_context(&audio_codec_context);
-
-
+    return finish(ret, "writing the trailer");
 }
 
 AudioProperties FFmpegAudioAdapter::GetProperties() const {
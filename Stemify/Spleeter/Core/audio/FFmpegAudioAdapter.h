@@ -7,7 +7,8 @@
 #pragma once
 
 #include "AudioProperties.h"
-#include "WaveForm.h"
+#include "SampleConversion.h"
+#include "Waveform.h"
 
 extern "C"
 {
@@ -17,11 +18,13 @@ extern "C"
 #include <libavutil/frame.h>
 #include <libavutil/mem.h>
 #include <libavutil/opt.h>
+#include <libavutil/samplefmt.h>
 #include <libswresample/swresample.h>
 }
 
 #include <algorithm>
 #include <cstdint>
+#include <functional>
 #include <string>
 #include <utility>
 
@@ -40,17 +43,94 @@ class FFmpegAudioAdapter {
     /// @returns Loaded data as waveform
     Waveform Load(const std::string& path, const std::int32_t sample_rate);
 
+    /// @brief Loads only the [start_seconds, end_seconds) span of the audio file denoted by the given path.
+    ///
+    /// Seeks close to the start of the span instead of decoding the file from the beginning, so the cost is
+    /// proportional to the length of the span. The returned waveform is interleaved stereo and is shorter than
+    /// requested when the span reaches past the end of the file.
+    ///
+    /// @param path [in]           - Path of the audio file to load data from.
+    /// @param sample_rate [in]    - Sample rate to load audio with.
+    /// @param start_seconds [in]  - Start of the span.
+    /// @param end_seconds [in]    - End of the span (exclusive).
+    ///
+    /// @returns Loaded data of the span as waveform
+    Waveform LoadRegion(const std::string& path,
+                        const std::int32_t sample_rate,
+                        const double start_seconds,
+                        const double end_seconds);
+
+    /// @brief Reads the header of the audio file denoted by the given path without decoding it.
+    ///
+    /// @param path [in]         - Path of the audio file to probe.
+    /// @param sample_rate [in]  - Sample rate the number of frames is expressed in.
+    ///
+    /// @returns Estimated properties, nb_frames is 0 when the file cannot be read or has no known duration.
+    AudioProperties Probe(const std::string& path, const std::int32_t sample_rate) const;
+
+    /// @brief Loads the audio file denoted by the given path by decoding nb_segments time segments in parallel.
+    ///
+    /// Each segment is decoded on its own thread with its own demuxer and decoder after a seek (with pre-roll to
+    /// prime the decoder), directly into its range of the returned waveform. Seams are checked to be
+    /// sample-accurate; non-seekable or short inputs, and inputs whose seams do not line up, are decoded
+    /// sequentially with Load instead. The returned waveform is interleaved stereo.
+    ///
+    /// @param path [in]         - Path of the audio file to load data from.
+    /// @param sample_rate [in]  - Sample rate to load audio with.
+    /// @param nb_segments [in]  - Maximum number of segments decoded at once.
+    ///
+    /// @returns Loaded data as waveform
+    Waveform LoadParallel(const std::string& path, const std::int32_t sample_rate, const std::int32_t nb_segments);
+
     /// @brief Write waveform data to the file denoted by the given path using FFMPEG process.
     ///
     /// @param path [in]        - Path of the audio file to save data in.
     /// @param waveform [in]    - Waveform data to write.
     /// @param sample_rate [in] - Sample rate to write file in.
     /// @param bitrate [in]     - Bitrate of the written audio file.
-    void Save(const std::string& path,
+    ///
+    /// @returns false when the file could not be written completely, the libav error is printed.
+    bool Save(const std::string& path,
               const Waveform& waveform,
               const std::int32_t sample_rate,
               const std::int32_t bitrate);
 
+    /// @brief Producer of interleaved stereo samples: fills dst with `frames` frames starting at frame `offset`.
+    using SampleSource = std::function<void(float* dst, std::int64_t offset, std::int32_t frames)>;
+
+    /// @brief Encode samples pulled from a source to the file denoted by the given path, without holding
+    ///        the whole signal in memory.
+    ///
+    /// @param path [in]        - Path of the audio file to save data in.
+    /// @param source [in]      - Producer of the samples to write, called with increasing offsets.
+    /// @param nb_frames [in]   - Number of frames to write.
+    /// @param sample_rate [in] - Sample rate to write file in.
+    /// @param bitrate [in]     - Bitrate of the written audio file.
+    ///
+    /// @returns false when the file could not be written completely, the libav error is printed.
+    bool Save(const std::string& path,
+              const SampleSource& source,
+              const std::int64_t nb_frames,
+              const std::int32_t sample_rate,
+              const std::int32_t bitrate);
+
+    /// @brief Write a stem stored with a compact sample type, converting it back to float block by block.
+    template <typename Sample>
+    bool Save(const std::string& path,
+              const BasicWaveform<Sample>& waveform,
+              const std::int32_t sample_rate,
+              const std::int32_t bitrate) {
+        const Sample* src = waveform.data.data();
+        return Save(
+            path,
+            [src](float* dst, std::int64_t offset, std::int32_t frames) {
+                ConvertSamples(src + offset * 2, dst, static_cast<std::size_t>(frames) * 2);
+            },
+            static_cast<std::int64_t>(waveform.data.size() / 2),
+            sample_rate,
+            bitrate);
+    }
+
     /// @brief Provide properties of the Waveform (nb_frames, nb_channels, sample_rate)
     ///
     /// @return audio properties
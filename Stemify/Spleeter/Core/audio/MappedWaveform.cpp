@@ -0,0 +1,88 @@
+//
+//  MappedWaveform.cpp
+//  Stemify
+//
+//  Created by XueyuanXiao on 2025/8/19.
+//
+#include "MappedWaveform.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <utility>
+
+namespace spleeter {
+
+MappedWaveform::MappedWaveform(const std::string& path) : data_(nullptr), size_(0) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat file_stat {};
+    if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+        void* mapping = mmap(nullptr, static_cast<std::size_t>(file_stat.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping != MAP_FAILED) {
+            // Stems are read front to back by the mixer and the encoder
+            madvise(mapping, static_cast<std::size_t>(file_stat.st_size), MADV_SEQUENTIAL);
+            data_ = static_cast<const float*>(mapping);
+            size_ = static_cast<std::size_t>(file_stat.st_size);
+        }
+    }
+    close(fd);
+}
+
+MappedWaveform::~MappedWaveform() {
+    Unmap();
+}
+
+MappedWaveform::MappedWaveform(MappedWaveform&& other) noexcept
+    : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {
+}
+
+MappedWaveform& MappedWaveform::operator=(MappedWaveform&& other) noexcept {
+    if (this != &other) {
+        Unmap();
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+}
+
+bool MappedWaveform::Write(const std::string& path, const Waveform& waveform) {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    const auto written = std::fwrite(waveform.data.data(), sizeof(float), waveform.data.size(), file);
+    const bool closed = std::fclose(file) == 0;
+    return closed && written == waveform.data.size();
+}
+
+bool MappedWaveform::IsValid() const {
+    return data_ != nullptr;
+}
+
+const float* MappedWaveform::GetData() const {
+    return data_;
+}
+
+std::int64_t MappedWaveform::GetNbFrames() const {
+    return static_cast<std::int64_t>(size_ / (sizeof(float) * GetNbChannels()));
+}
+
+std::int32_t MappedWaveform::GetNbChannels() const {
+    return 2;
+}
+
+void MappedWaveform::Unmap() {
+    if (data_) {
+        munmap(const_cast<float*>(data_), size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+}
+
+}  // namespace spleeter
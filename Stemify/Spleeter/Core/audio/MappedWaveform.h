@@ -0,0 +1,49 @@
+//
+//  MappedWaveform.h
+//  Stemify
+//
+//  Created by XueyuanXiao on 2025/8/19.
+//
+#pragma once
+
+#include "Waveform.h"
+
+#include <cstdint>
+#include <string>
+
+namespace spleeter {
+/// @brief Read-only memory mapping of a raw stem file (interleaved stereo float32, native endianness, no header).
+///
+/// Lets stems that were spilled to disk be mixed or encoded without reading them into memory first.
+class MappedWaveform {
+  public:
+    /// @brief Maps the raw stem file denoted by the given path, IsValid() tells whether it succeeded.
+    explicit MappedWaveform(const std::string& path);
+    ~MappedWaveform();
+
+    MappedWaveform(const MappedWaveform&) = delete;
+    MappedWaveform& operator=(const MappedWaveform&) = delete;
+    MappedWaveform(MappedWaveform&& other) noexcept;
+    MappedWaveform& operator=(MappedWaveform&& other) noexcept;
+
+    /// @brief Writes the waveform as a raw stem file that can be mapped later.
+    ///
+    /// @return true on success
+    static bool Write(const std::string& path, const Waveform& waveform);
+
+    bool IsValid() const;
+
+    /// @brief Interleaved stereo samples, nullptr when the mapping failed
+    const float* GetData() const;
+
+    std::int64_t GetNbFrames() const;
+
+    std::int32_t GetNbChannels() const;
+
+  private:
+    void Unmap();
+
+    const float* data_;
+    std::size_t size_;
+};
+}  // namespace spleeter
@@ -0,0 +1,141 @@
+//
+//  MemoryTracker.cpp
+//  Stemify
+//
+//  Created by XueyuanXiao on 2025/8/19.
+//
+#include "MemoryTracker.h"
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+namespace spleeter {
+
+MemoryTracker::MemoryTracker(std::size_t budget_bytes) : budget_bytes_(budget_bytes), usage_{} {
+    usage_.budget_bytes = budget_bytes;
+}
+
+bool MemoryTracker::TryAllocate(MemoryStage stage, std::size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (budget_bytes_ > 0 && GetTotalLocked() + bytes > budget_bytes_) {
+        return false;
+    }
+    AddLocked(stage, bytes);
+    return true;
+}
+
+void MemoryTracker::Allocate(MemoryStage stage, std::size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    AddLocked(stage, bytes);
+}
+
+void MemoryTracker::Release(MemoryStage stage, std::size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& current = usage_.current_bytes[static_cast<std::size_t>(stage)];
+    current -= std::min(current, bytes);
+}
+
+bool MemoryTracker::Fits(std::size_t bytes) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return budget_bytes_ == 0 || GetTotalLocked() + bytes <= budget_bytes_;
+}
+
+void MemoryTracker::ResetPeaks() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    usage_.peak_bytes = usage_.current_bytes;
+    usage_.total_peak_bytes = GetTotalLocked();
+}
+
+std::size_t MemoryTracker::GetBudgetBytes() const {
+    return budget_bytes_;
+}
+
+std::size_t MemoryTracker::GetCurrentBytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return GetTotalLocked();
+}
+
+MemoryUsage MemoryTracker::GetUsage() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return usage_;
+}
+
+std::size_t MemoryTracker::GetTotalLocked() const {
+    return std::accumulate(usage_.current_bytes.begin(), usage_.current_bytes.end(), std::size_t{0});
+}
+
+void MemoryTracker::AddLocked(MemoryStage stage, std::size_t bytes) {
+    const auto index = static_cast<std::size_t>(stage);
+    usage_.current_bytes[index] += bytes;
+    usage_.peak_bytes[index] = std::max(usage_.peak_bytes[index], usage_.current_bytes[index]);
+    usage_.total_peak_bytes = std::max(usage_.total_peak_bytes, GetTotalLocked());
+}
+
+ScopedMemory::ScopedMemory(MemoryTracker* tracker, MemoryStage stage, std::size_t bytes)
+    : ScopedMemory(tracker, stage, bytes, true) {
+    if (tracker_) {
+        tracker_->Allocate(stage_, bytes_);
+    }
+}
+
+ScopedMemory::ScopedMemory(MemoryTracker* tracker, MemoryStage stage, std::size_t bytes, bool valid)
+    : tracker_(tracker), stage_(stage), bytes_(bytes), valid_(valid) {
+}
+
+ScopedMemory ScopedMemory::TryAllocate(MemoryTracker* tracker, MemoryStage stage, std::size_t bytes) {
+    if (!tracker) {
+        return ScopedMemory(nullptr, stage, bytes, true);
+    }
+    if (!tracker->TryAllocate(stage, bytes)) {
+        return ScopedMemory(nullptr, stage, 0, false);
+    }
+    return ScopedMemory(tracker, stage, bytes, true);
+}
+
+ScopedMemory::~ScopedMemory() {
+    Release();
+}
+
+ScopedMemory::ScopedMemory(ScopedMemory&& other) noexcept
+    : tracker_(std::exchange(other.tracker_, nullptr)),
+      stage_(other.stage_),
+      bytes_(std::exchange(other.bytes_, 0)),
+      valid_(other.valid_) {
+}
+
+ScopedMemory& ScopedMemory::operator=(ScopedMemory&& other) noexcept {
+    if (this != &other) {
+        Release();
+        tracker_ = std::exchange(other.tracker_, nullptr);
+        stage_ = other.stage_;
+        bytes_ = std::exchange(other.bytes_, 0);
+        valid_ = other.valid_;
+    }
+    return *this;
+}
+
+void ScopedMemory::Resize(std::size_t bytes) {
+    if (tracker_) {
+        if (bytes > bytes_) {
+            tracker_->Allocate(stage_, bytes - bytes_);
+        } else {
+            tracker_->Release(stage_, bytes_ - bytes);
+        }
+    }
+    bytes_ = bytes;
+}
+
+bool ScopedMemory::IsValid() const {
+    return valid_;
+}
+
+void ScopedMemory::Release() {
+    if (tracker_) {
+        tracker_->Release(stage_, bytes_);
+        tracker_ = nullptr;
+    }
+    bytes_ = 0;
+}
+
+}  // namespace spleeter
@@ -0,0 +1,86 @@
+//
+//  MemoryTracker.h
+//  Stemify
+//
+//  Created by XueyuanXiao on 2025/8/19.
+//
+#pragma once
+
+#include "MemoryUsage.h"
+
+#include <cstddef>
+#include <mutex>
+
+namespace spleeter {
+/// @brief Attributes the bytes held by a separation job to its stages, keeps their high-water marks and enforces
+///        a hard budget for the whole job.
+///
+/// The tracker does not allocate anything itself: the code owning a buffer records it (see ScopedMemory) and
+/// asks TryAllocate before growing, so a job that would not fit degrades or stops instead of being OOM-killed.
+class MemoryTracker {
+  public:
+    /// @brief Creates a tracker with the given budget in bytes, 0 means unlimited
+    explicit MemoryTracker(std::size_t budget_bytes = 0);
+
+    /// @brief Records bytes for the stage if the job stays within budget.
+    ///
+    /// @return false, recording nothing, when the budget would be exceeded
+    bool TryAllocate(MemoryStage stage, std::size_t bytes);
+
+    /// @brief Records bytes for the stage regardless of the budget, for memory that is already held
+    void Allocate(MemoryStage stage, std::size_t bytes);
+
+    void Release(MemoryStage stage, std::size_t bytes);
+
+    /// @brief Tells whether bytes more would stay within budget
+    bool Fits(std::size_t bytes) const;
+
+    /// @brief Starts a new job: clears the high-water marks, keeps what is currently held and the budget
+    void ResetPeaks();
+
+    std::size_t GetBudgetBytes() const;
+
+    std::size_t GetCurrentBytes() const;
+
+    MemoryUsage GetUsage() const;
+
+  private:
+    std::size_t GetTotalLocked() const;
+    void AddLocked(MemoryStage stage, std::size_t bytes);
+
+    mutable std::mutex mutex_;
+    const std::size_t budget_bytes_;
+    MemoryUsage usage_;
+};
+
+/// @brief Records bytes with a tracker for as long as it lives. A null tracker disables the accounting.
+class ScopedMemory {
+  public:
+    /// @brief Records bytes regardless of the budget
+    ScopedMemory(MemoryTracker* tracker, MemoryStage stage, std::size_t bytes);
+
+    /// @brief Records bytes if they fit in the budget, IsValid() tells whether they did
+    static ScopedMemory TryAllocate(MemoryTracker* tracker, MemoryStage stage, std::size_t bytes);
+
+    ~ScopedMemory();
+
+    ScopedMemory(const ScopedMemory&) = delete;
+    ScopedMemory& operator=(const ScopedMemory&) = delete;
+    ScopedMemory(ScopedMemory&& other) noexcept;
+    ScopedMemory& operator=(ScopedMemory&& other) noexcept;
+
+    /// @brief Replaces the recorded amount, e.g. with the actual size once a buffer is filled
+    void Resize(std::size_t bytes);
+
+    bool IsValid() const;
+
+  private:
+    ScopedMemory(MemoryTracker* tracker, MemoryStage stage, std::size_t bytes, bool valid);
+    void Release();
+
+    MemoryTracker* tracker_;
+    MemoryStage stage_;
+    std::size_t bytes_;
+    bool valid_;
+};
+}  // namespace spleeter
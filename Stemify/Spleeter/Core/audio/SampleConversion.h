@@ -0,0 +1,187 @@
+//
+//  SampleConversion.h
+//  Stemify
+//
+//  Created by XueyuanXiao on 2025/8/19.
+//
+#pragma once
+
+#include "SampleTypes.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/// Kernels converting blocks of samples between float and the compact stem storage types. Half conversions use
+/// the hardware instructions where the target has them (F16C on x86 built with -mf16c or -march=native, NEON on
+/// arm64); everything else is written as branch-free select arithmetic so that the compiler vectorizes it.
+namespace spleeter {
+
+namespace detail {
+inline std::uint32_t FloatBits(float value) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline float BitsFloat(std::uint32_t bits) {
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/// @brief `condition ? if_true : if_false` as a mask, which keeps the compiler from turning it back into a branch
+///        around the floating point operations feeding it (it may not speculate them under -ftrapping-math)
+inline std::uint32_t Select(bool condition, std::uint32_t if_true, std::uint32_t if_false) {
+    return if_false ^ ((if_true ^ if_false) & (0u - static_cast<std::uint32_t>(condition)));
+}
+
+/// @brief float to binary16, round to nearest even, overflow to infinity. Every case is computed and the
+///        result selected, so that loops over it have no control flow.
+inline std::uint16_t FloatToHalf(float value) {
+    const std::uint32_t f32_infinity = 255u << 23;
+    const std::uint32_t f16_max = (127u + 16u) << 23;
+    const std::uint32_t denormal_magic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+    std::uint32_t bits = FloatBits(value);
+    const std::uint32_t sign = bits & 0x80000000u;
+    bits ^= sign;
+
+    const std::uint32_t inf_nan = bits > f32_infinity ? 0x7e00u : 0x7c00u;
+    const std::uint32_t denormal = FloatBits(BitsFloat(bits) + BitsFloat(denormal_magic)) - denormal_magic;
+    const std::uint32_t mantissa_odd = (bits >> 13) & 1u;
+    const std::uint32_t normal = (bits + (static_cast<std::uint32_t>(15 - 127) << 23) + 0xfffu + mantissa_odd) >> 13;
+
+    std::uint32_t half = Select(bits < (113u << 23), denormal, normal);
+    half = Select(bits >= f16_max, inf_nan, half);
+    return static_cast<std::uint16_t>(half | (sign >> 16));
+}
+
+/// @brief binary16 to float, exact, branch-free like FloatToHalf
+inline float HalfToFloat(std::uint16_t half) {
+    const std::uint32_t shifted_exponent = 0x7c00u << 13;
+
+    const std::uint32_t magnitude = (half & 0x7fffu) << 13;
+    const std::uint32_t exponent = magnitude & shifted_exponent;
+    const std::uint32_t normal = magnitude + ((127u - 15u) << 23);
+    const std::uint32_t inf_nan = normal + ((128u - 16u) << 23);
+    const std::uint32_t denormal = FloatBits(BitsFloat(normal + (1u << 23)) - BitsFloat(113u << 23));
+
+    std::uint32_t bits = Select(exponent == shifted_exponent, inf_nan, normal);
+    bits = Select(exponent == 0, denormal, bits);
+    return BitsFloat(bits | (static_cast<std::uint32_t>(half & 0x8000u) << 16));
+}
+
+/// @brief Stateless hash giving a reproducible pseudo-random value per sample index
+inline std::uint32_t HashIndex(std::uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+/// @brief Rounds to the nearest integer (ties to even) for |value| < 2^22, by pushing the fraction out of the
+///        mantissa instead of calling lrintf
+inline float RoundNearest(float value) {
+    const float magic = 12582912.0f;  // 1.5 * 2^23
+    return (value + magic) - magic;
+}
+}  // namespace detail
+
+/// @brief Full scale of the int16 stem storage
+constexpr float kInt16FullScale = 32767.0f;
+
+inline void ConvertSamples(const float* src, float* dst, std::size_t n) {
+    std::copy(src, src + n, dst);
+}
+
+inline void ConvertSamples(const float* __restrict src, Half* __restrict dst, std::size_t n) {
+    std::size_t i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= n; i += 8) {
+        const __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), half);
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 4 <= n; i += 4) {
+        vst1_u16(reinterpret_cast<std::uint16_t*>(dst + i), vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src + i))));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i].bits = detail::FloatToHalf(src[i]);
+    }
+}
+
+/// @brief float to int16 with triangular (TPDF) dither of +/-1 LSB. `index` is the position of src[0] in the
+///        whole signal, it seeds the dither so the result does not depend on how the signal is split into blocks.
+inline void ConvertSamples(const float* __restrict src,
+                           std::int16_t* __restrict dst,
+                           std::size_t n,
+                           std::uint64_t index = 0) {
+    for (std::size_t i = 0; i < n; ++i) {
+        const std::uint32_t random = detail::HashIndex(static_cast<std::uint32_t>(index + i));
+        // Both halves fit in 16 bits, converting them as signed keeps the conversion vectorizable
+        const float dither = static_cast<float>(static_cast<std::int32_t>(random & 0xffffu) -
+                                                static_cast<std::int32_t>(random >> 16)) *
+                             (1.0f / 65536.0f);
+        // Rounded before clipping: values out of RoundNearest's range are out of full scale too and get clipped,
+        // while clipping first lets the compiler branch around the rounding for the constant clipped values
+        const float rounded = detail::RoundNearest(src[i] * kInt16FullScale + dither);
+        const float clipped = std::min(std::max(rounded, -kInt16FullScale), kInt16FullScale);
+        dst[i] = static_cast<std::int16_t>(static_cast<std::int32_t>(clipped));
+    }
+}
+
+inline void ConvertSamples(const Half* __restrict src, float* __restrict dst, std::size_t n) {
+    std::size_t i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= n; i += 8) {
+        const __m128i half = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(half));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 4 <= n; i += 4) {
+        const uint16x4_t half = vld1_u16(reinterpret_cast<const std::uint16_t*>(src + i));
+        vst1q_f32(dst + i, vcvt_f32_f16(vreinterpret_f16_u16(half)));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = detail::HalfToFloat(src[i].bits);
+    }
+}
+
+inline void ConvertSamples(const std::int16_t* __restrict src, float* __restrict dst, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        dst[i] = static_cast<float>(src[i]) * (1.0f / kInt16FullScale);
+    }
+}
+
+/// @brief Converts n samples that start at sample `index` of the whole signal into the stem type Sample. Only
+///        the int16 conversion depends on the position (it seeds the dither), the others ignore it.
+template <typename Sample>
+inline void ConvertSamplesAt(const float* src, Sample* dst, std::size_t n, std::uint64_t index) {
+    if constexpr (std::is_same_v<Sample, std::int16_t>) {
+        ConvertSamples(src, dst, n, index);
+    } else {
+        ConvertSamples(src, dst, n);
+    }
+}
+
+/// @brief Adds n samples of src to dst
+inline void AccumulateSamples(const float* __restrict src, float* __restrict dst, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        dst[i] += src[i];
+    }
+}
+
+}  // namespace spleeter
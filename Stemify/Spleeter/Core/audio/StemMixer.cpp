@@ -0,0 +1,134 @@
+//
+//  StemMixer.cpp
+//  Stemify
+//
+//  Created by XueyuanXiao on 2025/8/19.
+//
+#include "StemMixer.h"
+
+#include <algorithm>
+
+namespace spleeter {
+
+namespace {
+/// @brief Frames between two evaluations of the automation; gains are ramped linearly in between
+constexpr std::int32_t kAutomationBlockFrames = 64;
+
+float GetAutomationValue(const std::vector<AutomationPoint>& points, double time_seconds, float default_value) {
+    if (points.empty()) {
+        return default_value;
+    }
+    if (time_seconds <= points.front().time_seconds) {
+        return points.front().value;
+    }
+    if (time_seconds >= points.back().time_seconds) {
+        return points.back().value;
+    }
+    const auto next = std::upper_bound(points.begin(), points.end(), time_seconds,
+                                       [](double time, const AutomationPoint& point) { return time < point.time_seconds; });
+    const auto previous = next - 1;
+    const double span = next->time_seconds - previous->time_seconds;
+    const double ratio = span > 0.0 ? (time_seconds - previous->time_seconds) / span : 1.0;
+    return static_cast<float>(previous->value + (next->value - previous->value) * ratio);
+}
+
+/// @brief dst += src * gain for interleaved stereo, with per-channel gains ramped linearly over the block
+void MixRamped(float* __restrict dst,
+               const float* __restrict src,
+               std::int32_t frames,
+               float left_gain,
+               float right_gain,
+               float left_step,
+               float right_step) {
+    for (std::int32_t i = 0; i < frames; ++i) {
+        const float left = left_gain + left_step * static_cast<float>(i);
+        const float right = right_gain + right_step * static_cast<float>(i);
+        dst[2 * i] += src[2 * i] * left;
+        dst[2 * i + 1] += src[2 * i + 1] * right;
+    }
+}
+}  // namespace
+
+StemMixer::StemMixer(std::int32_t sample_rate) : sample_rate_(sample_rate), stems_() {
+}
+
+namespace {
+/// @brief Reader of float stems, points straight into the samples
+StemMixer::StemReader ReadFloatSamples(const float* samples) {
+    return [samples](std::int64_t offset, std::int32_t frames, std::vector<float>& scratch) {
+        return samples + offset * 2;
+    };
+}
+}  // namespace
+
+void StemMixer::AddStem(const Waveform& waveform, const StemAutomation& automation) {
+    stems_.push_back(Stem{ReadFloatSamples(waveform.data.data()), static_cast<std::int64_t>(waveform.data.size() / 2), automation});
+}
+
+void StemMixer::AddStem(const MappedWaveform& waveform, const StemAutomation& automation) {
+    stems_.push_back(Stem{ReadFloatSamples(waveform.GetData()), waveform.IsValid() ? waveform.GetNbFrames() : 0, automation});
+}
+
+std::int64_t StemMixer::GetNbFrames() const {
+    std::int64_t nb_frames{0};
+    for (const auto& stem : stems_) {
+        nb_frames = std::max(nb_frames, stem.nb_frames);
+    }
+    return nb_frames;
+}
+
+void StemMixer::GetChannelGains(const Stem& stem, std::int64_t frame, float& left, float& right) const {
+    const double time_seconds = static_cast<double>(frame) / sample_rate_;
+    const float mute = std::clamp(GetAutomationValue(stem.automation.mute, time_seconds, 0.0f), 0.0f, 1.0f);
+    const float gain = GetAutomationValue(stem.automation.gain, time_seconds, 1.0f) * (1.0f - mute);
+    const float pan = std::clamp(GetAutomationValue(stem.automation.pan, time_seconds, 0.0f), -1.0f, 1.0f);
+    left = gain * std::min(1.0f, 1.0f - pan);
+    right = gain * std::min(1.0f, 1.0f + pan);
+}
+
+void StemMixer::Render(float* dst, std::int64_t offset, std::int32_t frames) const {
+    std::fill(dst, dst + static_cast<std::int64_t>(frames) * 2, 0.0f);
+
+    std::vector<float> scratch;
+    for (const auto& stem : stems_) {
+        const auto stem_frames = static_cast<std::int32_t>(
+            std::clamp<std::int64_t>(stem.nb_frames - offset, 0, frames));
+        if (stem_frames == 0) {
+            continue;
+        }
+        const float* samples = stem.read(offset, stem_frames, scratch);
+        for (std::int32_t block = 0; block < stem_frames; block += kAutomationBlockFrames) {
+            const auto block_frames = std::min(kAutomationBlockFrames, stem_frames - block);
+            float left_begin, right_begin, left_end, right_end;
+            GetChannelGains(stem, offset + block, left_begin, right_begin);
+            GetChannelGains(stem, offset + block + block_frames, left_end, right_end);
+            if (left_begin == 0.0f && right_begin == 0.0f && left_end == 0.0f && right_end == 0.0f) {
+                continue;
+            }
+            MixRamped(dst + static_cast<std::int64_t>(block) * 2,
+                      samples + static_cast<std::int64_t>(block) * 2,
+                      block_frames,
+                      left_begin,
+                      right_begin,
+                      (left_end - left_begin) / block_frames,
+                      (right_end - right_begin) / block_frames);
+        }
+    }
+}
+
+Waveform StemMixer::Render() const {
+    const auto nb_frames = GetNbFrames();
+    Waveform waveform{};
+    waveform.nb_frames = static_cast<std::int32_t>(nb_frames);
+    waveform.nb_channels = 2;
+    waveform.data.resize(static_cast<size_t>(nb_frames) * 2);
+
+    const std::int32_t chunk_frames = 1 << 16;
+    for (std::int64_t offset = 0; offset < nb_frames; offset += chunk_frames) {
+        const auto frames = static_cast<std::int32_t>(std::min<std::int64_t>(chunk_frames, nb_frames - offset));
+        Render(waveform.data.data() + offset * 2, offset, frames);
+    }
+    return waveform;
+}
+
+}  // namespace spleeter
@@ -0,0 +1,94 @@
+//
+//  StemMixer.h
+//  Stemify
+//
+//  Created by XueyuanXiao on 2025/8/19.
+//
+#pragma once
+
+#include "MappedWaveform.h"
+#include "SampleConversion.h"
+#include "Waveform.h"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace spleeter {
+
+/// @brief Value of an automated parameter at a given time
+struct AutomationPoint {
+    double time_seconds;
+    float value;
+};
+
+/// @brief Mix settings of one stem. Each parameter is either a single point (constant) or a list of points
+///        sorted by time; values are interpolated linearly between points and held before the first and
+///        after the last one. An empty list keeps the default.
+struct StemAutomation {
+    /// @brief Linear gain, 1 by default
+    std::vector<AutomationPoint> gain{};
+
+    /// @brief Balance from -1 (left only) to 1 (right only), 0 by default
+    std::vector<AutomationPoint> pan{};
+
+    /// @brief 1 mutes the stem, 0 by default. Changes are ramped over one block to avoid clicks
+    std::vector<AutomationPoint> mute{};
+};
+
+/// @brief Offline mixer rendering N interleaved stereo stems with per-stem gain, mute and pan automation.
+///
+/// Stems are not copied: the waveforms or mappings given to AddStem must outlive the mixer. Rendering is done
+/// block by block so the mix can be fed straight into FFmpegAudioAdapter::Save without a full-length buffer.
+class StemMixer {
+  public:
+    /// @brief Constructor.
+    ///
+    /// @param sample_rate [in] - Sample rate of the stems, used to place the automation points.
+    explicit StemMixer(std::int32_t sample_rate);
+
+    /// @brief Returns interleaved float frames [offset, offset + frames) of a stem, either pointing into the stem
+    ///        itself or into scratch after a conversion
+    using StemReader = std::function<const float*(std::int64_t offset, std::int32_t frames, std::vector<float>& scratch)>;
+
+    void AddStem(const Waveform& waveform, const StemAutomation& automation = {});
+
+    void AddStem(const MappedWaveform& waveform, const StemAutomation& automation = {});
+
+    /// @brief Adds a stem stored with a compact sample type, converted to float block by block while mixing
+    template <typename Sample>
+    void AddStem(const BasicWaveform<Sample>& waveform, const StemAutomation& automation = {}) {
+        const Sample* samples = waveform.data.data();
+        stems_.push_back(Stem{
+            [samples](std::int64_t offset, std::int32_t frames, std::vector<float>& scratch) -> const float* {
+                scratch.resize(static_cast<std::size_t>(frames) * 2);
+                ConvertSamples(samples + offset * 2, scratch.data(), scratch.size());
+                return scratch.data();
+            },
+            static_cast<std::int64_t>(waveform.data.size() / 2),
+            automation});
+    }
+
+    /// @brief Length of the mix: the length of the longest stem
+    std::int64_t GetNbFrames() const;
+
+    /// @brief Renders frames [offset, offset + frames) of the mix as interleaved stereo into dst
+    void Render(float* dst, std::int64_t offset, std::int32_t frames) const;
+
+    /// @brief Renders the whole mix
+    Waveform Render() const;
+
+  private:
+    struct Stem {
+        StemReader read;
+        std::int64_t nb_frames;
+        StemAutomation automation;
+    };
+
+    /// @brief Left and right gains of a stem at the given frame
+    void GetChannelGains(const Stem& stem, std::int64_t frame, float& left, float& right) const;
+
+    std::int32_t sample_rate_;
+    std::vector<Stem> stems_;
+};
+}  // namespace spleeter
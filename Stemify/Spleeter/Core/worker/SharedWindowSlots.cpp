@@ -0,0 +1,79 @@
+//
+//  SharedWindowSlots.cpp
+//  Stemify
+//
+//  Created by XueyuanXiao on 2025/8/19.
+//
+#include "SharedWindowSlots.h"
+
+#include <sys/mman.h>
+
+namespace spleeter {
+
+namespace {
+/// Headers and buffers start on their own cache lines so that neighbouring slots never share one
+constexpr std::size_t kSlotAlignment = 64;
+
+/// Samples per frame of the window buffers
+constexpr std::size_t kChannels = 2;
+
+std::size_t AlignUp(std::size_t bytes) {
+    return (bytes + kSlotAlignment - 1) / kSlotAlignment * kSlotAlignment;
+}
+}  // namespace
+
+SharedWindowSlots::SharedWindowSlots(std::size_t nb_slots, std::size_t capacity_frames, std::size_t nb_outputs)
+    : nb_slots_(nb_slots), capacity_frames_(capacity_frames), nb_outputs_(nb_outputs), data_(nullptr), size_(0) {
+    const std::size_t size = nb_slots_ * GetSlotBytes();
+    if (size == 0) {
+        return;
+    }
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+    if (mapping != MAP_FAILED) {
+        data_ = static_cast<std::uint8_t*>(mapping);
+        size_ = size;
+    }
+}
+
+SharedWindowSlots::~SharedWindowSlots() {
+    if (data_) {
+        munmap(data_, size_);
+    }
+}
+
+bool SharedWindowSlots::IsValid() const {
+    return data_ != nullptr;
+}
+
+std::size_t SharedWindowSlots::GetNbSlots() const {
+    return nb_slots_;
+}
+
+std::size_t SharedWindowSlots::GetCapacityFrames() const {
+    return capacity_frames_;
+}
+
+std::size_t SharedWindowSlots::GetNbOutputs() const {
+    return nb_outputs_;
+}
+
+SlotHeader& SharedWindowSlots::GetHeader(std::size_t slot) const {
+    return *reinterpret_cast<SlotHeader*>(data_ + slot * GetSlotBytes());
+}
+
+float* SharedWindowSlots::GetInput(std::size_t slot) const {
+    return reinterpret_cast<float*>(data_ + slot * GetSlotBytes() + AlignUp(sizeof(SlotHeader)));
+}
+
+float* SharedWindowSlots::GetOutput(std::size_t slot, std::size_t output) const {
+    const std::size_t buffer_bytes = AlignUp(capacity_frames_ * kChannels * sizeof(float));
+    return reinterpret_cast<float*>(data_ + slot * GetSlotBytes() + AlignUp(sizeof(SlotHeader)) +
+                                    (1 + output) * buffer_bytes);
+}
+
+std::size_t SharedWindowSlots::GetSlotBytes() const {
+    const std::size_t buffer_bytes = AlignUp(capacity_frames_ * kChannels * sizeof(float));
+    return AlignUp(sizeof(SlotHeader)) + (1 + nb_outputs_) * buffer_bytes;
+}
+
+}  // namespace spleeter
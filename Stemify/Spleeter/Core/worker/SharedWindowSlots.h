@@ -0,0 +1,74 @@
+//
+//  SharedWindowSlots.h
+//  Stemify
+//
+//  Created by XueyuanXiao on 2025/8/19.
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace spleeter {
+/// @brief State of a slot, written by whoever owns it at the moment
+enum class SlotStatus : std::int32_t {
+    /// @brief Input written by the supervisor, waiting for a worker
+    Pending = 0,
+    /// @brief Outputs written by the worker
+    Done = 1,
+    /// @brief The worker could not run the window (e.g. the model returned fewer tracks)
+    Failed = 2,
+};
+
+/// @brief Fixed-size header at the start of every slot
+struct SlotHeader {
+    /// @brief Frames of the window input
+    std::int32_t input_frames;
+    /// @brief Frames of each output, at most the slot capacity
+    std::int32_t output_frames;
+    /// @brief Number of outputs the worker wrote
+    std::int32_t nb_outputs;
+    SlotStatus status;
+};
+
+/// @brief Window buffers shared between a supervisor and the worker processes it forks.
+///
+/// One anonymous shared mapping holds nb_slots slots, each with a header, room for one interleaved stereo window
+/// and room for nb_outputs model outputs of the same size. The mapping is inherited across fork(), so PCM never
+/// goes through a pipe: only slot indices do, and a slot belongs to exactly one process between two messages.
+class SharedWindowSlots {
+  public:
+    /// @brief Maps the slots, IsValid() tells whether it succeeded
+    SharedWindowSlots(std::size_t nb_slots, std::size_t capacity_frames, std::size_t nb_outputs);
+    ~SharedWindowSlots();
+
+    SharedWindowSlots(const SharedWindowSlots&) = delete;
+    SharedWindowSlots& operator=(const SharedWindowSlots&) = delete;
+
+    bool IsValid() const;
+
+    std::size_t GetNbSlots() const;
+
+    /// @brief Most frames a window (and each of its outputs) can have
+    std::size_t GetCapacityFrames() const;
+
+    std::size_t GetNbOutputs() const;
+
+    SlotHeader& GetHeader(std::size_t slot) const;
+
+    /// @brief Interleaved stereo input of the slot, GetCapacityFrames() frames long
+    float* GetInput(std::size_t slot) const;
+
+    /// @brief Interleaved stereo output of the slot for the given track, GetCapacityFrames() frames long
+    float* GetOutput(std::size_t slot, std::size_t output) const;
+
+  private:
+    std::size_t GetSlotBytes() const;
+
+    std::size_t nb_slots_;
+    std::size_t capacity_frames_;
+    std::size_t nb_outputs_;
+    std::uint8_t* data_;
+    std::size_t size_;
+};
+}  // namespace spleeter
@@ -0,0 +1,434 @@
+//
+//  WorkerPool.cpp
+//  Stemify
+//
+//  Created by XueyuanXiao on 2025/8/19.
+//
+#include "WorkerPool.h"
+#include "SampleConversion.h"
+#include "TFLiteInferenceEngine.h"
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+
+namespace spleeter {
+
+namespace {
+const int kSampleRate = 44100;
+const int kChannels = 2;
+
+/// Windows a worker holds at once: the one it runs and the next one
+constexpr size_t kSlotsPerWorker = 2;
+
+/// Workers a window may fail on (crash or bad result) before the job is given up
+constexpr int kMaxWindowAttempts = 3;
+
+/// Message a worker sends once its engine is loaded
+constexpr std::uint32_t kWorkerReady = 0xffffffffu;
+
+bool WriteMessage(int fd, std::uint32_t message) {
+    ssize_t written;
+    do {
+        written = write(fd, &message, sizeof(message));
+    } while (written < 0 && errno == EINTR);
+    return written == static_cast<ssize_t>(sizeof(message));
+}
+
+/// Reads one message, returns false on end of file or error. Messages are smaller than PIPE_BUF, so they are
+/// never split across reads.
+bool ReadMessage(int fd, std::uint32_t& message) {
+    ssize_t nb_read;
+    do {
+        nb_read = read(fd, &message, sizeof(message));
+    } while (nb_read < 0 && errno == EINTR);
+    return nb_read == static_cast<ssize_t>(sizeof(message));
+}
+}  // namespace
+
+WorkerPool::WorkerPool(const InferenceEngineParameters& params,
+                       size_t num_tracks,
+                       size_t nb_workers,
+                       float max_window_seconds)
+    : params_(params),
+      num_tracks_(num_tracks),
+      max_window_seconds_(max_window_seconds),
+      slots_(nb_workers * kSlotsPerWorker, static_cast<size_t>(max_window_seconds * kSampleRate), num_tracks),
+      workers_(nb_workers, WorkerProcess{-1, -1, -1, {}}),
+      audio_processor_() {
+    if (!slots_.IsValid()) {
+        std::cerr << "Failed to map the shared window slots" << std::endl;
+        return;
+    }
+    // A write to the task pipe of a dead worker must fail with EPIPE instead of killing the supervisor
+    signal(SIGPIPE, SIG_IGN);
+    for (size_t worker_idx = 0; worker_idx < workers_.size(); ++worker_idx) {
+        Spawn(worker_idx);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    for (size_t worker_idx = 0; worker_idx < workers_.size(); ++worker_idx) {
+        Reap(worker_idx);
+    }
+}
+
+void WorkerPool::setDelegate(std::weak_ptr<IAudioProcessorDelegate> delegate) {
+    delegate_ = delegate;
+}
+
+bool WorkerPool::IsRunning() const {
+    return std::any_of(workers_.begin(), workers_.end(), [](const auto& worker) { return worker.pid > 0; });
+}
+
+float WorkerPool::GetMaxWindowSeconds() const {
+    return max_window_seconds_;
+}
+
+bool WorkerPool::Spawn(size_t worker_idx) {
+    int task_pipe[2];
+    int done_pipe[2];
+    if (pipe(task_pipe) != 0) {
+        return false;
+    }
+    if (pipe(done_pipe) != 0) {
+        close(task_pipe[0]);
+        close(task_pipe[1]);
+        return false;
+    }
+
+    const pid_t pid = fork();
+    if (pid < 0) {
+        for (const int fd : {task_pipe[0], task_pipe[1], done_pipe[0], done_pipe[1]}) {
+            close(fd);
+        }
+        return false;
+    }
+    if (pid == 0) {
+        close(task_pipe[1]);
+        close(done_pipe[0]);
+        RunWorker(task_pipe[0], done_pipe[1]);
+    }
+
+    close(task_pipe[0]);
+    close(done_pipe[1]);
+    auto& worker = workers_[worker_idx];
+    worker = WorkerProcess{pid, task_pipe[1], done_pipe[0], {}};
+
+    std::uint32_t message;
+    if (!ReadMessage(worker.done_fd, message) || message != kWorkerReady) {
+        std::cerr << "Worker " << pid << " could not load the model" << std::endl;
+        Reap(worker_idx);
+        return false;
+    }
+    return true;
+}
+
+std::vector<size_t> WorkerPool::Reap(size_t worker_idx) {
+    auto& worker = workers_[worker_idx];
+    if (worker.pid <= 0) {
+        return {};
+    }
+    // Closing the task pipe makes a live worker leave its loop; a dead one only needs to be waited for
+    close(worker.task_fd);
+    close(worker.done_fd);
+    int status = 0;
+    while (waitpid(worker.pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    if (WIFSIGNALED(status)) {
+        std::cerr << "Worker " << worker.pid << " was killed by signal " << WTERMSIG(status) << std::endl;
+    }
+    auto slots = std::move(worker.slots);
+    worker = WorkerProcess{-1, -1, -1, {}};
+    return slots;
+}
+
+void WorkerPool::RunWorker(int task_fd, int done_fd) {
+    // Drop the supervisor ends inherited from the other workers, otherwise they would never see end of file
+    for (const auto& worker : workers_) {
+        if (worker.pid > 0) {
+            close(worker.task_fd);
+            close(worker.done_fd);
+        }
+    }
+    signal(SIGPIPE, SIG_DFL);
+
+    TFLiteInferenceEngine engine(params_);
+    engine.Init();
+    if (!engine.IsInitialized() || !WriteMessage(done_fd, kWorkerReady)) {
+        _exit(EXIT_FAILURE);
+    }
+
+    const size_t capacity_frames = slots_.GetCapacityFrames();
+    std::uint32_t slot;
+    while (ReadMessage(task_fd, slot)) {
+        auto& header = slots_.GetHeader(slot);
+        const float* input = slots_.GetInput(slot);
+
+        Waveform window;
+        window.nb_frames = header.input_frames;
+        window.nb_channels = kChannels;
+        window.data.assign(input, input + static_cast<size_t>(header.input_frames) * kChannels);
+        engine.Execute(window);
+        const auto results = engine.GetResults();
+        engine.ClearResults();
+
+        if (results.size() != slots_.GetNbOutputs()) {
+            header.status = SlotStatus::Failed;
+        } else {
+            size_t output_frames = capacity_frames;
+            for (size_t output = 0; output < results.size(); ++output) {
+                const auto& result = results[output];
+                const size_t frames = std::min(capacity_frames, result.data.size() / kChannels);
+                std::copy(result.data.begin(), result.data.begin() + frames * kChannels, slots_.GetOutput(slot, output));
+                output_frames = std::min(output_frames, frames);
+            }
+            header.output_frames = static_cast<std::int32_t>(output_frames);
+            header.nb_outputs = static_cast<std::int32_t>(results.size());
+            header.status = SlotStatus::Done;
+        }
+        if (!WriteMessage(done_fd, slot)) {
+            break;
+        }
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+template <typename Sample>
+std::vector<BasicWaveform<Sample>> WorkerPool::ProcessAudio(const Waveform& inputWaveform, float window_seconds) {
+    using Clock = std::chrono::steady_clock;
+
+    if (!slots_.IsValid() || inputWaveform.nb_channels != kChannels) {
+        return {};
+    }
+
+    reportStart();
+
+    const size_t total_frames = inputWaveform.nb_frames;
+    const auto plan = audio_processor_.PlanWindows(total_frames, std::min(window_seconds, max_window_seconds_));
+
+    std::vector<BasicWaveform<Sample>> track_results(num_tracks_);
+    for (auto& track : track_results) {
+        track.nb_frames = static_cast<std::int32_t>(total_frames);
+        track.nb_channels = kChannels;
+        track.data.resize(total_frames * kChannels, Sample{});
+    }
+
+    std::deque<size_t> pending_windows;
+    for (size_t window_idx = 0; window_idx < plan.size(); ++window_idx) {
+        pending_windows.push_back(window_idx);
+    }
+    std::vector<int> attempts(plan.size(), 0);
+    std::vector<size_t> slot_windows(slots_.GetNbSlots(), 0);
+    std::vector<Clock::time_point> slot_begins(slots_.GetNbSlots());
+    std::vector<size_t> free_slots;
+    for (size_t slot = slots_.GetNbSlots(); slot > 0; --slot) {
+        free_slots.push_back(slot - 1);
+    }
+
+    const size_t persistent_bytes = inputWaveform.data.capacity() * sizeof(float) +
+                                    num_tracks_ * total_frames * kChannels * sizeof(Sample);
+    const size_t slot_bytes = (1 + num_tracks_) * slots_.GetCapacityFrames() * kChannels * sizeof(float);
+    const auto job_begin = Clock::now();
+    double total_window_seconds = 0.0;
+    double max_window_seconds = 0.0;
+    size_t windows_done = 0;
+    size_t frames_done = 0;
+    bool failed = false;
+
+    // A window goes back to the front of the queue; the job is given up once it failed too often
+    auto requeue = [&](size_t slot) {
+        const size_t window_idx = slot_windows[slot];
+        free_slots.push_back(slot);
+        if (++attempts[window_idx] >= kMaxWindowAttempts) {
+            std::cerr << "Window at frame " << plan[window_idx].window_start << " failed " << attempts[window_idx]
+                      << " times" << std::endl;
+            failed = true;
+        }
+        pending_windows.push_front(window_idx);
+    };
+    auto replace_worker = [&](size_t worker_idx) {
+        for (const auto slot : Reap(worker_idx)) {
+            requeue(slot);
+        }
+        Spawn(worker_idx);
+    };
+
+    while (windows_done < plan.size() && !failed) {
+        // Hand pending windows to the workers with room for them
+        for (size_t worker_idx = 0; worker_idx < workers_.size(); ++worker_idx) {
+            auto& worker = workers_[worker_idx];
+            while (worker.pid > 0 && worker.slots.size() < kSlotsPerWorker && !pending_windows.empty() &&
+                   !free_slots.empty()) {
+                const size_t window_idx = pending_windows.front();
+                const auto& window = plan[window_idx];
+                const size_t slot = free_slots.back();
+
+                const size_t copy_frames = std::min(window.window_frames, total_frames - window.window_start);
+                float* input = slots_.GetInput(slot);
+                std::copy(inputWaveform.data.begin() + window.window_start * kChannels,
+                          inputWaveform.data.begin() + (window.window_start + copy_frames) * kChannels,
+                          input);
+                std::fill(input + copy_frames * kChannels, input + window.window_frames * kChannels, 0.0f);
+                slots_.GetHeader(slot) =
+                    SlotHeader{static_cast<std::int32_t>(window.window_frames), 0, 0, SlotStatus::Pending};
+
+                if (!WriteMessage(worker.task_fd, static_cast<std::uint32_t>(slot))) {
+                    replace_worker(worker_idx);
+                    break;
+                }
+                pending_windows.pop_front();
+                free_slots.pop_back();
+                slot_windows[slot] = window_idx;
+                slot_begins[slot] = Clock::now();
+                worker.slots.push_back(slot);
+            }
+        }
+        if (!IsRunning()) {
+            std::cerr << "No worker left" << std::endl;
+            failed = true;
+            break;
+        }
+
+        std::vector<pollfd> poll_fds;
+        std::vector<size_t> poll_workers;
+        for (size_t worker_idx = 0; worker_idx < workers_.size(); ++worker_idx) {
+            if (workers_[worker_idx].pid > 0) {
+                poll_fds.push_back(pollfd{workers_[worker_idx].done_fd, POLLIN, 0});
+                poll_workers.push_back(worker_idx);
+            }
+        }
+        if (poll(poll_fds.data(), poll_fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            failed = true;
+            break;
+        }
+
+        for (size_t i = 0; i < poll_fds.size(); ++i) {
+            if (poll_fds[i].revents == 0) {
+                continue;
+            }
+            const size_t worker_idx = poll_workers[i];
+            auto& worker = workers_[worker_idx];
+            std::uint32_t slot;
+            if (!ReadMessage(worker.done_fd, slot) ||
+                std::find(worker.slots.begin(), worker.slots.end(), slot) == worker.slots.end()) {
+                // End of file: the worker is gone together with the windows it held
+                replace_worker(worker_idx);
+                continue;
+            }
+            worker.slots.erase(std::find(worker.slots.begin(), worker.slots.end(), slot));
+
+            const auto& header = slots_.GetHeader(slot);
+            const auto& window = plan[slot_windows[slot]];
+            const size_t output_frames = static_cast<size_t>(std::max(0, header.output_frames));
+            if (header.status != SlotStatus::Done || output_frames < window.extract_start + window.extract_frames) {
+                requeue(slot);
+                continue;
+            }
+
+            const size_t extract_frames = window.extract_frames;
+            for (size_t track_idx = 0; track_idx < num_tracks_; ++track_idx) {
+                const size_t dst_begin = window.result_pos * kChannels;
+                ConvertSamplesAt(slots_.GetOutput(slot, track_idx) + window.extract_start * kChannels,
+                                 track_results[track_idx].data.data() + dst_begin,
+                                 extract_frames * kChannels,
+                                 dst_begin);
+            }
+            free_slots.push_back(slot);
+
+            const double window_seconds_taken =
+                std::chrono::duration<double>(Clock::now() - slot_begins[slot]).count();
+            total_window_seconds += window_seconds_taken;
+            max_window_seconds = std::max(max_window_seconds, window_seconds_taken);
+            ++windows_done;
+            frames_done += extract_frames;
+
+            // Windows overlap in time, so the ETA comes from the job throughput rather than from window latency
+            const double elapsed_seconds = std::chrono::duration<double>(Clock::now() - job_begin).count();
+            const double audio_seconds_per_second =
+                elapsed_seconds > 0.0 ? static_cast<double>(frames_done) / kSampleRate / elapsed_seconds : 0.0;
+            const double average_window_seconds = total_window_seconds / windows_done;
+            reportTelemetry(ProcessingTelemetry{
+                windows_done,
+                plan.size(),
+                audio_seconds_per_second,
+                average_window_seconds,
+                audio_seconds_per_second > 0.0
+                    ? static_cast<double>(total_frames - frames_done) / kSampleRate / audio_seconds_per_second
+                    : 0.0,
+                persistent_bytes + slots_.GetNbSlots() * slot_bytes});
+            reportProgress(static_cast<float>(frames_done) / static_cast<float>(total_frames));
+        }
+    }
+
+    const double wall_seconds = std::chrono::duration<double>(Clock::now() - job_begin).count();
+    const double audio_seconds = static_cast<double>(frames_done) / kSampleRate;
+    reportFinish(ProcessingSummary{
+        windows_done,
+        audio_seconds,
+        wall_seconds,
+        wall_seconds > 0.0 ? audio_seconds / wall_seconds : 0.0,
+        windows_done > 0 ? total_window_seconds / windows_done : 0.0,
+        max_window_seconds,
+        persistent_bytes + slots_.GetNbSlots() * slot_bytes,
+        !failed});
+
+    if (failed) {
+        // Let the workers finish what they hold so their slots are free for the next job
+        for (size_t worker_idx = 0; worker_idx < workers_.size(); ++worker_idx) {
+            auto& worker = workers_[worker_idx];
+            while (worker.pid > 0 && !worker.slots.empty()) {
+                std::uint32_t slot;
+                if (!ReadMessage(worker.done_fd, slot)) {
+                    replace_worker(worker_idx);
+                    break;
+                }
+                worker.slots.erase(std::remove(worker.slots.begin(), worker.slots.end(), slot), worker.slots.end());
+            }
+        }
+        return {};
+    }
+
+    return track_results;
+}
+
+template std::vector<BasicWaveform<float>> WorkerPool::ProcessAudio<float>(const Waveform&, float);
+template std::vector<BasicWaveform<Half>> WorkerPool::ProcessAudio<Half>(const Waveform&, float);
+template std::vector<BasicWaveform<std::int16_t>> WorkerPool::ProcessAudio<std::int16_t>(const Waveform&, float);
+
+void WorkerPool::reportProgress(float progress) {
+    if (auto delegate = delegate_.lock()) {
+        delegate->onProgressUpdate(progress);
+    }
+}
+
+void WorkerPool::reportStart() {
+    if (auto delegate = delegate_.lock()) {
+        delegate->onProcessingStart();
+    }
+}
+
+void WorkerPool::reportTelemetry(const ProcessingTelemetry& telemetry) {
+    if (auto delegate = delegate_.lock()) {
+        delegate->onTelemetryUpdate(telemetry);
+    }
+}
+
+void WorkerPool::reportFinish(const ProcessingSummary& summary) {
+    if (auto delegate = delegate_.lock()) {
+        delegate->onProcessingFinish(summary);
+    }
+}
+
+}  // namespace spleeter
@@ -0,0 +1,89 @@
+//
+//  WorkerPool.h
+//  Stemify
+//
+//  Created by XueyuanXiao on 2025/8/19.
+//
+#pragma once
+
+#include "AudioProcessor.h"
+#include "InferenceEngineParameters.h"
+#include "SharedWindowSlots.h"
+#include "Waveform.h"
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace spleeter {
+/// @brief Runs the windows of a separation on a pool of worker processes, each holding its own warm engine.
+///
+/// The supervisor (the process creating the pool) plans the windows like AudioProcessor::ProcessAudio, copies
+/// each one into a slot of SharedWindowSlots and sends the slot index to a worker over a pipe; the worker runs
+/// the model and writes the outputs back into the same slot. Every worker has up to two slots in flight, so it
+/// can start its next window while the supervisor stitches the previous one.
+///
+/// A worker that dies (crash, OOM kill) is reaped, its windows are requeued on the other workers and a
+/// replacement is forked. Workers are forked from the supervisor, so the pool must be created, and used, while
+/// the process runs no other thread. Not available on iOS, where processes cannot fork.
+class WorkerPool {
+  public:
+    /// @brief Forks nb_workers workers, each loading the model from params. Windows are limited to
+    ///        max_window_seconds; IsRunning() tells whether at least one worker came up.
+    WorkerPool(const InferenceEngineParameters& params, size_t num_tracks, size_t nb_workers, float max_window_seconds);
+
+    /// @brief Stops the workers: they exit once their task pipe is closed
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void setDelegate(std::weak_ptr<IAudioProcessorDelegate> delegate);
+
+    bool IsRunning() const;
+
+    /// @brief Longest window the slots can hold
+    float GetMaxWindowSeconds() const;
+
+    /// @brief Separates the input into the pool's num_tracks stems, see AudioProcessor::ProcessAudio.
+    ///        window_seconds is capped to GetMaxWindowSeconds(). Returns empty stems when the job could not
+    ///        complete: no worker left, or a window that failed on several workers in a row.
+    template <typename Sample = float>
+    std::vector<BasicWaveform<Sample>> ProcessAudio(const Waveform& inputWaveform, float window_seconds);
+
+  private:
+    struct WorkerProcess {
+        pid_t pid;
+        /// Supervisor end of the pipe carrying slot indices to the worker
+        int task_fd;
+        /// Supervisor end of the pipe carrying finished slot indices back
+        int done_fd;
+        /// Slots sent to the worker and not returned yet, in order
+        std::vector<size_t> slots;
+    };
+
+    /// Forks a worker into workers_[worker_idx] and waits until its engine is loaded, returns false if it failed
+    bool Spawn(size_t worker_idx);
+
+    /// Closes the pipes of a worker and waits for it to exit, returns the slots it had in flight
+    std::vector<size_t> Reap(size_t worker_idx);
+
+    /// Body of a worker process, never returns
+    [[noreturn]] void RunWorker(int task_fd, int done_fd);
+
+    void reportProgress(float progress);
+    void reportStart();
+    void reportTelemetry(const ProcessingTelemetry& telemetry);
+    void reportFinish(const ProcessingSummary& summary);
+
+    const InferenceEngineParameters params_;
+    const size_t num_tracks_;
+    const float max_window_seconds_;
+    SharedWindowSlots slots_;
+    std::vector<WorkerProcess> workers_;
+    AudioProcessor audio_processor_;
+    std::weak_ptr<IAudioProcessorDelegate> delegate_;
+};
+}  // namespace spleeter
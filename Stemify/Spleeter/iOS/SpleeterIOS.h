@@ -9,6 +9,8 @@
 typedef NS_ENUM(NSUInteger, SpleeterModel) {
     SpleeterModel2Stems,
     SpleeterModel5Stems,
+    /// One 5 stems pass that also saves 2stems_vocal / 2stems_accompaniment, summed from the 5 stems
+    SpleeterModel5StemsAnd2Stems,
 } NS_SWIFT_NAME(Spleeter.Model);
 
 NS_ASSUME_NONNULL_BEGIN
@@ -18,6 +20,10 @@ NS_SWIFT_NAME(Spleeter)
 
 @property (nonatomic, readonly, class) SpleeterIOS *sharedInstance NS_SWIFT_NAME(shared);
 
+/// Corrects the 2 stems of SpleeterModel5StemsAnd2Stems so they add up to the input, NO by default.
+/// Read when a job starts.
+@property (nonatomic, assign) BOOL mixtureConsistency;
+
 - (instancetype)init NS_UNAVAILABLE;
 
 - (void)processFileAt:(NSString*)path
@@ -28,5 +34,17 @@ NS_SWIFT_NAME(Spleeter)
            onProgress:(void(^)(float))progressHandler
          onCompletion:(void(^)(BOOL success, NSError * _Nullable error))completionHandler;
 
+/// Separates only the [startTime, endTime) span of the file, in seconds. Only that span (plus a little
+/// context for the model) is decoded and processed, and the saved stems cover exactly the requested span.
+- (void)processFileAt:(NSString*)path
+           usingModel:(SpleeterModel)model
+               format:(NSString*)format
+             fromTime:(NSTimeInterval)startTime
+               toTime:(NSTimeInterval)endTime
+               saveAt:(NSString*)folder
+              onStart:(void(^)(void))startHandler
+           onProgress:(void(^)(float))progressHandler
+         onCompletion:(void(^)(BOOL success, NSError * _Nullable error))completionHandler;
+
 @end
 NS_ASSUME_NONNULL_END
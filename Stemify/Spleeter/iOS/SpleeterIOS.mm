@@ -5,14 +5,20 @@
 //  Created by XueyuanXiao on 2025/8/25.
 //
 #import <sys/utsname.h>
+#import <os/proc.h>
 
 #import "TFLiteInferenceEngine.h"
-#import "FfmpegAudioAdapter.h"
+#import "FFmpegAudioAdapter.h"
 #import "AudioProcessor.h"
 #import "AudioProcessorDelegateImp.h"
+#import "MappedWaveform.h"
+#import "SeparationModels.h"
 
 #import "SpleeterIOS.h"
 
+/// Context decoded on each side of a requested region so the model sees the audio around its edges
+static const NSTimeInterval kRegionMarginSeconds = 3.0;
+
 @interface SpleeterIOS () <AudioProcessorViewDelegate> {
     std::shared_ptr<spleeter::TFLiteInferenceEngine> _interfaceEngine;
     std::shared_ptr<spleeter::FFmpegAudioAdapter> _audioAdapter;
@@ -53,31 +59,36 @@
 }
 
 - (void)processFileAt:(NSString *)path usingModel:(SpleeterModel)model format:(NSString*)format saveAt:(NSString *)folder onStart:(void (^)())startHandler onProgress:(void (^)(float))progressHandler onCompletion:(void (^)(BOOL, NSError * _Nullable))completionHandler {
-    _model = model;
     _onStartHandler = startHandler;
     _onProgressHandler = progressHandler;
     _onCompletionHandler = completionHandler;
     _format = [format copy];
-    spleeter::InferenceEngineParameters _2StemsInferenceEngineParams{
-        [[[NSBundle mainBundle] pathForResource:@"2stems" ofType:@"tflite"] UTF8String],
-        "waveform",
-        {"strided_slice_13", "strided_slice_23"},
-        "spleeter:2stems"};
-
-    spleeter::InferenceEngineParameters _5StemsInferenceEngineParams{
-        [[[NSBundle mainBundle] pathForResource:@"5stems" ofType:@"tflite"] UTF8String],
-        "waveform",
-        {"strided_slice_18", "strided_slice_38", "strided_slice_48", "strided_slice_28", "strided_slice_58"},
-        "spleeter:5stems"};
+    [self setUpModel:model];
+    [self doProcesFileAt:path saveAt:folder];
+}
+
+- (void)processFileAt:(NSString *)path usingModel:(SpleeterModel)model format:(NSString*)format fromTime:(NSTimeInterval)startTime toTime:(NSTimeInterval)endTime saveAt:(NSString *)folder onStart:(void (^)())startHandler onProgress:(void (^)(float))progressHandler onCompletion:(void (^)(BOOL, NSError * _Nullable))completionHandler {
+    _onStartHandler = startHandler;
+    _onProgressHandler = progressHandler;
+    _onCompletionHandler = completionHandler;
+    _format = [format copy];
+    [self setUpModel:model];
+    [self doProcessRegionOfFileAt:path fromTime:startTime toTime:endTime saveAt:folder];
+}
+
+- (void)setUpModel:(SpleeterModel)model {
+    _model = model;
     if (model == SpleeterModel2Stems) {
-        _interfaceEngine = std::make_shared<spleeter::TFLiteInferenceEngine>(_2StemsInferenceEngineParams);
+        const auto separationModel = spleeter::Make2StemsModel([[[NSBundle mainBundle] pathForResource:@"2stems" ofType:@"tflite"] UTF8String]);
+        _interfaceEngine = std::make_shared<spleeter::TFLiteInferenceEngine>(separationModel.parameters);
     } else {
-        _interfaceEngine = std::make_shared<spleeter::TFLiteInferenceEngine>(_5StemsInferenceEngineParams);
+        const auto separationModel = spleeter::Make5StemsModel([[[NSBundle mainBundle] pathForResource:@"5stems" ofType:@"tflite"] UTF8String]);
+        _interfaceEngine = std::make_shared<spleeter::TFLiteInferenceEngine>(separationModel.parameters);
     }
-    [self doProcesFileAt:path saveAt:folder];
 }
 
 - (void)doProcesFileAt:(NSString *)path saveAt:(NSString *)folder {
+    const BOOL mixtureConsistency = self.mixtureConsistency;
     dispatch_async(dispatch_get_global_queue(0, 0), ^{
         auto waveform_names_2stems = std::vector<std::string>{"vocal", "accompaniment"};
         auto waveform_names_5stems = std::vector<std::string>{"vocal", "drums", "bass", "piano", "accompaniment"};
@@ -94,32 +105,149 @@
             track_names = waveform_names_5stems;
         }
 
-        float window_seconds = [self getOptimalWindowSeconds:num_tracks];
+        const auto derivedStems = [self derivedStems];
+        for (const auto& derivedStem : derivedStems) {
+            track_names.push_back(derivedStem.name);
+        }
+
+        // Stay within what the system lets this process allocate (0 when it does not tell): the decoded input is
+        // already part of it
+        const size_t availableBytes = os_proc_available_memory();
+        const size_t inputBytes = fullWaveform.data.capacity() * sizeof(float);
+        const auto plan = self->_audioProcessor->PlanMemory(fullWaveform.nb_frames, num_tracks,
+                                                            [self getOptimalWindowSeconds:num_tracks], sizeof(float),
+                                                            availableBytes > 0 ? availableBytes + inputBytes : 0,
+                                                            derivedStems.size());
+        float window_seconds = plan.window_seconds;
 
 #if DEBUG
-        NSLog(@"using %zustems，window size: %.1fs", num_tracks, window_seconds);
+        NSLog(@"using %zustems，window size: %.1fs, spill stems: %d, estimated peak: %zuMB", num_tracks, window_seconds,
+              plan.spill_stems, plan.peak_bytes >> 20);
 #endif
-        const auto waveforms = self->_audioProcessor->ProcessAudio(fullWaveform, self->_interfaceEngine, num_tracks, window_seconds);
+        if (plan.spill_stems) {
+            [self spillAndSaveWaveform:fullWaveform tracks:track_names derivedStems:derivedStems windowSeconds:window_seconds
+                mixtureConsistency:mixtureConsistency saveAt:folder];
+            return;
+        }
+        const auto waveforms = self->_audioProcessor->ProcessAudioWithDerivedStems(fullWaveform, self->_interfaceEngine, num_tracks,
+                                                                                   window_seconds, derivedStems, mixtureConsistency);
 #if DEBUG
         NSLog(@"finished，got %zu tracks", waveforms.size());
 #endif
 
+        BOOL saved = YES;
+        for (size_t i = 0; i < waveforms.size() && i < track_names.size(); ++i) {
+            NSString *trackName = [NSString stringWithUTF8String:track_names[i].c_str()];
+            NSString *trackPath = [folder stringByAppendingPathComponent:[NSString stringWithFormat:@"%@.%@", trackName, self->_format]];
+
+            saved = self->_audioAdapter->Save(trackPath.UTF8String, waveforms[i], 44100, 128000) && saved;
+
+#if DEBUG
+            NSLog(@"saved track：%@ -> %@", trackName, trackPath);
+#endif
+        }
+        const BOOL separated = !waveforms.empty() && saved;
+        dispatch_async(dispatch_get_main_queue(), ^{
+            self.onCompletionHandler(separated, nil);
+        });
+    });
+}
+
+- (void)doProcessRegionOfFileAt:(NSString *)path fromTime:(NSTimeInterval)startTime toTime:(NSTimeInterval)endTime saveAt:(NSString *)folder {
+    const BOOL mixtureConsistency = self.mixtureConsistency;
+    dispatch_async(dispatch_get_global_queue(0, 0), ^{
+        auto waveform_names_2stems = std::vector<std::string>{"vocal", "accompaniment"};
+        auto waveform_names_5stems = std::vector<std::string>{"vocal", "drums", "bass", "piano", "accompaniment"};
+        const int sampleRate = 44100;
+
+        // Decode the requested span plus some context on both sides so the model output at the region
+        // boundaries matches what a full-file separation would produce.
+        const NSTimeInterval regionStart = std::max(0.0, startTime);
+        const NSTimeInterval regionEnd = std::max(regionStart, endTime);
+        const NSTimeInterval paddedStart = std::max(0.0, regionStart - kRegionMarginSeconds);
+        const NSTimeInterval paddedEnd = regionEnd + kRegionMarginSeconds;
+        const auto paddedWaveform = self->_audioAdapter->LoadRegion(path.UTF8String, sampleRate, paddedStart, paddedEnd);
+
+        const size_t leadFrames = static_cast<size_t>(std::llround((regionStart - paddedStart) * sampleRate));
+        const size_t regionFrames = static_cast<size_t>(std::llround((regionEnd - regionStart) * sampleRate));
+
+        size_t num_tracks = self->_model == SpleeterModel2Stems ? 2 : 5;
+        auto track_names = num_tracks == 2 ? waveform_names_2stems : waveform_names_5stems;
+        const auto derivedStems = [self derivedStems];
+        for (const auto& derivedStem : derivedStems) {
+            track_names.push_back(derivedStem.name);
+        }
+
+        float window_seconds = [self getOptimalWindowSeconds:num_tracks];
+
+#if DEBUG
+        NSLog(@"using %zustems，region: %.2fs - %.2fs, decoded %d frames", num_tracks, regionStart, regionEnd, paddedWaveform.nb_frames);
+#endif
+        const auto waveforms = self->_audioProcessor->ProcessRegion(paddedWaveform, self->_interfaceEngine, num_tracks,
+                                                                    window_seconds, leadFrames, regionFrames,
+                                                                    derivedStems, mixtureConsistency);
+
+        BOOL saved = YES;
         for (size_t i = 0; i < waveforms.size() && i < track_names.size(); ++i) {
             NSString *trackName = [NSString stringWithUTF8String:track_names[i].c_str()];
             NSString *trackPath = [folder stringByAppendingPathComponent:[NSString stringWithFormat:@"%@.%@", trackName, self->_format]];
 
-            self->_audioAdapter->Save(trackPath.UTF8String, waveforms[i], 44100, 128000);
+            saved = self->_audioAdapter->Save(trackPath.UTF8String, waveforms[i], sampleRate, 128000) && saved;
 
 #if DEBUG
             NSLog(@"saved track：%@ -> %@", trackName, trackPath);
 #endif
         }
+        const BOOL separated = !waveforms.empty() && saved;
         dispatch_async(dispatch_get_main_queue(), ^{
-            self.onCompletionHandler(YES, nil);
+            self.onCompletionHandler(separated, nil);
         });
     });
 }
 
+/// Stems computed from the model outputs on top of them, for the models that have some
+- (std::vector<spleeter::DerivedStem>)derivedStems {
+    if (_model == SpleeterModel5StemsAnd2Stems) {
+        return spleeter::Make2StemsFrom5Stems();
+    }
+    return {};
+}
+
+/// Separates with the stems written to temporary raw files instead of memory, then encodes them from mappings
+- (void)spillAndSaveWaveform:(const spleeter::Waveform&)waveform tracks:(const std::vector<std::string>&)trackNames derivedStems:(const std::vector<spleeter::DerivedStem>&)derivedStems windowSeconds:(float)windowSeconds mixtureConsistency:(BOOL)mixtureConsistency saveAt:(NSString *)folder {
+    std::vector<std::string> spillPaths;
+    for (const auto& trackName : trackNames) {
+        NSString *spillName = [NSString stringWithFormat:@"spill-%@-%s.f32", [NSUUID UUID].UUIDString, trackName.c_str()];
+        spillPaths.push_back([NSTemporaryDirectory() stringByAppendingPathComponent:spillName].UTF8String);
+    }
+
+    BOOL separated = _audioProcessor->ProcessAudioToFiles(waveform, _interfaceEngine, trackNames.size() - derivedStems.size(),
+                                                          windowSeconds, spillPaths, derivedStems, mixtureConsistency);
+    for (size_t i = 0; separated && i < trackNames.size(); ++i) {
+        const spleeter::MappedWaveform stem(spillPaths[i]);
+        if (!stem.IsValid()) {
+            separated = NO;
+            continue;
+        }
+        NSString *trackName = [NSString stringWithUTF8String:trackNames[i].c_str()];
+        NSString *trackPath = [folder stringByAppendingPathComponent:[NSString stringWithFormat:@"%@.%@", trackName, _format]];
+        const float* data = stem.GetData();
+        const auto channels = stem.GetNbChannels();
+        separated = _audioAdapter->Save(trackPath.UTF8String,
+                                        [data, channels](float* dst, std::int64_t offset, std::int32_t frames) {
+                                            std::copy(data + offset * channels, data + (offset + frames) * channels, dst);
+                                        },
+                                        stem.GetNbFrames(), 44100, 128000);
+    }
+    for (const auto& spillPath : spillPaths) {
+        [[NSFileManager defaultManager] removeItemAtPath:[NSString stringWithUTF8String:spillPath.c_str()] error:nil];
+    }
+
+    dispatch_async(dispatch_get_main_queue(), ^{
+        self.onCompletionHandler(separated, nil);
+    });
+}
+
 - (float)getOptimalWindowSeconds:(size_t)numTracks {
     NSProcessInfo *processInfo = [NSProcessInfo processInfo];
     unsigned long long totalMemory = processInfo.physicalMemory;